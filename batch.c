@@ -0,0 +1,399 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<pthread.h>
+#include<assert.h>
+
+#include<sys/types.h>
+
+#include "./batch.h"
+#include "./pool.h"
+
+struct ImHTTP_Batch_Worker {
+    ImHTTP_Batch *batch;
+    pthread_t thread;
+    bool thread_started;
+    // * One keep-alive connection per host:port
+    ImHTTP_Pool pool;
+
+    // * Request indices, a ring of batch->count slots guarded by `mutex`.
+    // * The worker takes from the front, thieves from the back.
+    pthread_mutex_t mutex;
+    size_t *queue;
+    size_t queue_head;
+    size_t queue_count;
+};
+
+static void batch_options_defaults(ImHTTP_Batch_Options *options) {
+    if(options->workers == 0) options->workers = IMHTTP_BATCH_DEFAULT_WORKERS;
+    if(options->workers > IMHTTP_BATCH_MAX_WORKERS) options->workers = IMHTTP_BATCH_MAX_WORKERS;
+    if(options->pipeline_depth == 0) options->pipeline_depth = IMHTTP_BATCH_DEFAULT_PIPELINE_DEPTH;
+    if(options->pipeline_depth > IMHTTP_BATCH_MAX_PIPELINE_DEPTH) options->pipeline_depth = IMHTTP_BATCH_MAX_PIPELINE_DEPTH;
+    if(options->max_attempts == 0) options->max_attempts = IMHTTP_BATCH_DEFAULT_MAX_ATTEMPTS;
+    if(options->max_body_size == 0) options->max_body_size = IMHTTP_BATCH_DEFAULT_MAX_BODY_SIZE;
+}
+
+static size_t batch_queue_at(const ImHTTP_Batch_Worker *worker, size_t i) {
+    return worker->queue[(worker->queue_head + i) % worker->batch->count];
+}
+
+static void batch_queue_push_back(ImHTTP_Batch_Worker *worker, size_t index) {
+    assert(worker->queue_count < worker->batch->count);
+    worker->queue[(worker->queue_head + worker->queue_count) % worker->batch->count] = index;
+    worker->queue_count += 1;
+}
+
+static void batch_queue_push_front(ImHTTP_Batch_Worker *worker, size_t index) {
+    assert(worker->queue_count < worker->batch->count);
+    worker->queue_head = (worker->queue_head + worker->batch->count - 1) % worker->batch->count;
+    worker->queue[worker->queue_head] = index;
+    worker->queue_count += 1;
+}
+
+static size_t batch_queue_pop_front(ImHTTP_Batch_Worker *worker) {
+    assert(worker->queue_count > 0);
+    size_t index = worker->queue[worker->queue_head];
+    worker->queue_head = (worker->queue_head + 1) % worker->batch->count;
+    worker->queue_count -= 1;
+    return index;
+}
+
+static bool batch_same_origin(const ImHTTP_Batch_Request *a, const ImHTTP_Batch_Request *b) {
+    return strcmp(a->host, b->host) == 0 && strcmp(a->port, b->port) == 0;
+}
+
+// * Takes the next request off the front of the queue, and the GET requests
+// * to the same host:port right behind it if it is a GET itself
+static size_t batch_take(ImHTTP_Batch_Worker *worker, size_t *group) {
+    const ImHTTP_Batch *batch = worker->batch;
+    size_t count = 0;
+    pthread_mutex_lock(&worker->mutex);
+    if(worker->queue_count > 0) {
+	group[count++] = batch_queue_pop_front(worker);
+	const ImHTTP_Batch_Request *first = &batch->requests[group[0]];
+	while(first->method == IMHTTP_GET && count < batch->options.pipeline_depth && worker->queue_count > 0) {
+	    const ImHTTP_Batch_Request *next = &batch->requests[batch_queue_at(worker, 0)];
+	    if(next->method != IMHTTP_GET || !batch_same_origin(first, next)) break;
+	    group[count++] = batch_queue_pop_front(worker);
+	}
+    }
+    pthread_mutex_unlock(&worker->mutex);
+    return count;
+}
+
+// * Moves the back half of the longest other queue into the (empty) queue
+// * of `worker`. Returns false when there is nothing left to take. Requests
+// * are only ever added to a queue by its own worker, so a worker that
+// * finds nothing can stop: what is still in flight gets finished by
+// * whoever holds it.
+static bool batch_steal(ImHTTP_Batch_Worker *worker) {
+    ImHTTP_Batch *batch = worker->batch;
+    for(;;) {
+	ImHTTP_Batch_Worker *victim = NULL;
+	size_t victim_count = 0;
+	for(size_t i = 0; i < batch->workers_count; ++i) {
+	    ImHTTP_Batch_Worker *other = &batch->workers[i];
+	    if(other == worker) continue;
+	    pthread_mutex_lock(&other->mutex);
+	    size_t count = other->queue_count;
+	    pthread_mutex_unlock(&other->mutex);
+	    if(count > victim_count) {
+		victim = other;
+		victim_count = count;
+	    }
+	}
+	if(victim == NULL) return false;
+
+	// * Locked one after the other, never both at once. The queue of
+	// * `worker` is empty and nobody else adds to it, so the stolen
+	// * indices can be kept in it while the victim is locked.
+	pthread_mutex_lock(&victim->mutex);
+	size_t take = (victim->queue_count + 1) / 2;
+	size_t keep = victim->queue_count - take;
+	for(size_t i = 0; i < take; ++i) {
+	    worker->queue[i] = batch_queue_at(victim, keep + i);
+	}
+	victim->queue_count = keep;
+	pthread_mutex_unlock(&victim->mutex);
+	// * Somebody else got there first, look again
+	if(take == 0) continue;
+
+	pthread_mutex_lock(&worker->mutex);
+	worker->queue_head = 0;
+	worker->queue_count = take;
+	pthread_mutex_unlock(&worker->mutex);
+
+	pthread_mutex_lock(&batch->mutex);
+	batch->steals += 1;
+	pthread_mutex_unlock(&batch->mutex);
+	return true;
+    }
+}
+
+static void batch_complete(ImHTTP_Batch *batch, size_t index) {
+    if(batch->options.on_complete != NULL) {
+	batch->options.on_complete(batch->options.user_data, index, &batch->responses[index]);
+    }
+    pthread_mutex_lock(&batch->mutex);
+    batch->completed[batch->completed_count++] = index;
+    pthread_cond_broadcast(&batch->completion);
+    pthread_mutex_unlock(&batch->mutex);
+}
+
+// * Puts the requests that have to be sent again back at the front of the
+// * queue, in their order
+static void batch_requeue(ImHTTP_Batch_Worker *worker, const size_t *group, size_t count) {
+    if(count == 0) return;
+    pthread_mutex_lock(&worker->mutex);
+    for(size_t i = count; i > 0; --i) {
+	batch_queue_push_front(worker, group[i - 1]);
+    }
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+// * A try of `index` failed. Returns true if it goes back to the queue.
+static bool batch_failed(ImHTTP_Batch *batch, size_t index, const char *error, bool retry) {
+    ImHTTP_Batch_Response *response = &batch->responses[index];
+    response->attempts += 1;
+    if(retry && batch->requests[index].method == IMHTTP_GET && response->attempts < batch->options.max_attempts) {
+	pthread_mutex_lock(&batch->mutex);
+	batch->retries += 1;
+	pthread_mutex_unlock(&batch->mutex);
+	return true;
+    }
+    response->status_code = 0;
+    response->body_size = 0;
+    response->error = error;
+    batch_complete(batch, index);
+    return false;
+}
+
+// * Errors stick to `imhttp`, so the result of imhttp_req_end() covers the whole request
+static bool batch_send(ImHTTP *imhttp, const ImHTTP_Batch_Request *request) {
+    imhttp_req_begin(imhttp, request->method, request->resource);
+    imhttp_req_header(imhttp, "Host", request->host);
+    for(size_t i = 0; i < request->headers_count; ++i) {
+	imhttp_req_header(imhttp, request->headers[2 * i], request->headers[2 * i + 1]);
+    }
+    if(request->body != NULL) {
+	char content_length[32];
+	snprintf(content_length, sizeof(content_length), "%zu", request->body_size);
+	imhttp_req_header(imhttp, "Content-Length", content_length);
+	imhttp_req_headers_end(imhttp);
+	imhttp_req_body_chunk_sized(imhttp, request->body, request->body_size);
+    } else {
+	imhttp_req_headers_end(imhttp);
+    }
+    return imhttp_req_end(imhttp);
+}
+
+static bool batch_append(ImHTTP_Batch_Response *response, const char *data, size_t size) {
+    if(response->body_size + size > response->body_capacity) {
+	size_t capacity = response->body_capacity > 0 ? response->body_capacity : 1024;
+	while(capacity < response->body_size + size) capacity *= 2;
+	char *body = realloc(response->body, capacity);
+	if(body == NULL) return false;
+	response->body = body;
+	response->body_capacity = capacity;
+    }
+    memcpy(response->body + response->body_size, data, size);
+    response->body_size += size;
+    return true;
+}
+
+// * Reads the response to `index`. Returns NULL on success, the reason
+// * otherwise, with `retry` telling whether another try could do better.
+static const char *batch_receive(ImHTTP_Batch *batch, ImHTTP *imhttp, size_t index, bool *retry) {
+    ImHTTP_Batch_Response *response = &batch->responses[index];
+    response->body_size = 0;
+    *retry = true;
+
+    imhttp_res_begin(imhttp);
+    uint64_t status_code = imhttp_res_status_code(imhttp);
+    String_View name, value;
+    while(imhttp_res_next_header(imhttp, &name, &value)) {}
+    if(imhttp->res_error != NULL) return imhttp->res_error;
+
+    *retry = false;
+    if(imhttp->content_length > 0) {
+	if((uint64_t) imhttp->content_length > batch->options.max_body_size) return "The body is too big";
+	if(response->body_capacity < (size_t) imhttp->content_length) {
+	    char *body = realloc(response->body, imhttp->content_length);
+	    if(body == NULL) return "Out of memory";
+	    response->body = body;
+	    response->body_capacity = imhttp->content_length;
+	}
+    }
+
+    String_View chunk;
+    while(imhttp_res_next_body_chunk(imhttp, &chunk)) {
+	if(response->body_size + chunk.count > batch->options.max_body_size) return "The body is too big";
+	if(!batch_append(response, chunk.data, chunk.count)) return "Out of memory";
+    }
+    if(imhttp->res_error != NULL) {
+	*retry = true;
+	return imhttp->res_error;
+    }
+    imhttp_res_end(imhttp);
+
+    response->status_code = status_code;
+    response->error = NULL;
+    response->attempts += 1;
+    return NULL;
+}
+
+// * Sends `group` over one connection, pipelined if there is more than one
+static void batch_run(ImHTTP_Batch_Worker *worker, size_t *group, size_t count) {
+    ImHTTP_Batch *batch = worker->batch;
+    const ImHTTP_Batch_Request *first = &batch->requests[group[0]];
+
+    ImHTTP *imhttp = imhttp_pool_acquire(&worker->pool, first->host, first->port);
+    if(imhttp == NULL) {
+	// * Only the first one counts as tried
+	size_t retry_count = batch_failed(batch, group[0], "Could not connect", true) ? 1 : 0;
+	batch_requeue(worker, group + 1 - retry_count, count - 1 + retry_count);
+	return;
+    }
+
+    bool sent = true;
+    if(count > 1) imhttp_pipeline_begin(imhttp);
+    for(size_t i = 0; i < count && sent; ++i) {
+	sent = batch_send(imhttp, &batch->requests[group[i]]);
+    }
+    if(count > 1) sent = imhttp_pipeline_end(imhttp) && sent;
+
+    size_t done = 0;
+    if(!sent) {
+	// * Most likely a pooled connection the server closed in the
+	// * meantime. Only the first one counts as tried.
+	if(!batch_failed(batch, group[0], imhttp->req_error, true)) done = 1;
+    }
+    while(sent && done < count) {
+	bool retry;
+	const char *error = batch_receive(batch, imhttp, group[done], &retry);
+	if(error != NULL) {
+	    if(!batch_failed(batch, group[done], error, retry)) done += 1;
+	    break;
+	}
+	batch_complete(batch, group[done]);
+	done += 1;
+	// * The server will not answer the rest on this connection
+	if(!imhttp->keep_alive) break;
+    }
+    // * Closed unless the connection is clean and can be reused
+    imhttp_pool_release(&worker->pool, imhttp);
+    batch_requeue(worker, group + done, count - done);
+}
+
+static void *batch_worker_thread(void *arg) {
+    ImHTTP_Batch_Worker *worker = arg;
+    size_t group[IMHTTP_BATCH_MAX_PIPELINE_DEPTH];
+    for(;;) {
+	size_t count = batch_take(worker, group);
+	if(count > 0) {
+	    batch_run(worker, group, count);
+	} else if(!batch_steal(worker)) {
+	    break;
+	}
+    }
+    imhttp_pool_free(&worker->pool);
+    return NULL;
+}
+
+static void batch_release(ImHTTP_Batch *batch) {
+    if(batch->workers != NULL) {
+	for(size_t i = 0; i < batch->workers_count; ++i) {
+	    pthread_mutex_destroy(&batch->workers[i].mutex);
+	    free(batch->workers[i].queue);
+	}
+    }
+    if(batch->responses != NULL) {
+	for(size_t i = 0; i < batch->count; ++i) {
+	    free(batch->responses[i].body);
+	}
+    }
+    free(batch->workers);
+    free(batch->responses);
+    free(batch->completed);
+    pthread_cond_destroy(&batch->completion);
+    pthread_mutex_destroy(&batch->mutex);
+    memset(batch, 0, sizeof(*batch));
+}
+
+bool imhttp_batch_start(ImHTTP_Batch *batch, const ImHTTP_Batch_Request *requests, size_t count,
+			const ImHTTP_Batch_Options *options) {
+    memset(batch, 0, sizeof(*batch));
+    batch->requests = requests;
+    batch->count = count;
+    if(options != NULL) batch->options = *options;
+    batch_options_defaults(&batch->options);
+    pthread_mutex_init(&batch->mutex, NULL);
+    pthread_cond_init(&batch->completion, NULL);
+    if(count == 0) return true;
+
+    // * No more workers than requests
+    batch->workers_count = count < batch->options.workers ? count : batch->options.workers;
+    batch->workers = calloc(batch->workers_count, sizeof(*batch->workers));
+    batch->responses = calloc(count, sizeof(*batch->responses));
+    batch->completed = calloc(count, sizeof(*batch->completed));
+    bool ok = batch->workers != NULL && batch->responses != NULL && batch->completed != NULL;
+    for(size_t i = 0; ok && i < batch->workers_count; ++i) {
+	ImHTTP_Batch_Worker *worker = &batch->workers[i];
+	worker->batch = batch;
+	worker->pool.max_idle_per_host = 1;
+	worker->pool.net = batch->options.net;
+	pthread_mutex_init(&worker->mutex, NULL);
+	worker->queue = malloc(count * sizeof(*worker->queue));
+	ok = worker->queue != NULL;
+    }
+    if(!ok) {
+	batch_release(batch);
+	return false;
+    }
+
+    // * Neighbours stay together, they are likely to go to the same host
+    for(size_t i = 0; i < count; ++i) {
+	batch_queue_push_back(&batch->workers[i * batch->workers_count / count], i);
+    }
+
+    // * The queues of workers that did not start get stolen by the others
+    size_t started = 0;
+    for(size_t i = 0; i < batch->workers_count; ++i) {
+	ImHTTP_Batch_Worker *worker = &batch->workers[i];
+	worker->thread_started = pthread_create(&worker->thread, NULL, batch_worker_thread, worker) == 0;
+	if(worker->thread_started) started += 1;
+    }
+    if(started == 0) {
+	batch_release(batch);
+	return false;
+    }
+    return true;
+}
+
+bool imhttp_batch_next(ImHTTP_Batch *batch, size_t *index) {
+    pthread_mutex_lock(&batch->mutex);
+    while(batch->reported < batch->count && batch->reported == batch->completed_count) {
+	pthread_cond_wait(&batch->completion, &batch->mutex);
+    }
+    bool more = batch->reported < batch->count;
+    if(more) *index = batch->completed[batch->reported++];
+    pthread_mutex_unlock(&batch->mutex);
+    return more;
+}
+
+void imhttp_batch_wait(ImHTTP_Batch *batch) {
+    pthread_mutex_lock(&batch->mutex);
+    while(batch->completed_count < batch->count) {
+	pthread_cond_wait(&batch->completion, &batch->mutex);
+    }
+    pthread_mutex_unlock(&batch->mutex);
+}
+
+void imhttp_batch_free(ImHTTP_Batch *batch) {
+    for(size_t i = 0; i < batch->workers_count; ++i) {
+	if(batch->workers[i].thread_started) pthread_join(batch->workers[i].thread, NULL);
+    }
+    batch_release(batch);
+}
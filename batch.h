@@ -0,0 +1,135 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include<stdbool.h>
+#include<stddef.h>
+#include<stdint.h>
+#include<pthread.h>
+
+#include "./imhttp.h"
+#include "./net.h"
+
+// * Batch fan-out: many requests at once, responses as they finish.
+// *
+// * imhttp_batch_start() deals the requests out in order to `workers`
+// * threads, each with its own keep-alive connection per host:port (see
+// * pool.h), so at most `workers` connections to one host are open at a time.
+// * Consecutive GET requests to the same host:port go out pipelined, up to
+// * `pipeline_depth` of them in one write. A worker that runs out of
+// * requests steals the back half of the longest queue left, so a slow
+// * connection never holds up the rest of the batch.
+// *
+// * A GET that fails (not sent, connection lost, invalid response) is tried
+// * again on a new connection, up to `max_attempts` times. Requests that were
+// * pipelined behind it, or behind a response that closed the connection,
+// * are sent again without counting as an attempt. POST requests go out on
+// * their own and are never tried again, the server may have acted on them.
+// *
+// * Finished requests are reported by imhttp_batch_next() in the order they
+// * finished, or right away by `on_complete` on the worker thread.
+// *
+// * ImHTTP_Batch batch = {0};
+// * imhttp_batch_start(&batch, requests, count, NULL);
+// * size_t i;
+// * while(imhttp_batch_next(&batch, &i)) {
+// *     // * batch.responses[i].status_code, .body, .body_size, .error
+// * }
+// * imhttp_batch_free(&batch);
+
+#define IMHTTP_BATCH_DEFAULT_WORKERS 4
+#define IMHTTP_BATCH_DEFAULT_PIPELINE_DEPTH 8
+#define IMHTTP_BATCH_DEFAULT_MAX_ATTEMPTS 3
+#define IMHTTP_BATCH_DEFAULT_MAX_BODY_SIZE (64 * 1024 * 1024)
+#define IMHTTP_BATCH_MAX_WORKERS 64
+#define IMHTTP_BATCH_MAX_PIPELINE_DEPTH 64
+
+typedef struct {
+    ImHTTP_Method method;
+    const char *host;
+    const char *port;
+    const char *resource;
+    // * Extra header fields as name, value pairs: `headers_count` pairs,
+    // * 2 * headers_count strings. Host is always sent.
+    const char *const *headers;
+    size_t headers_count;
+    // * Sent with a Content-Length if not NULL
+    const char *body;
+    size_t body_size;
+} ImHTTP_Batch_Request;
+
+typedef struct {
+    // * 0 if no complete response came
+    uint64_t status_code;
+    // * Owned by the batch, valid until imhttp_batch_free()
+    char *body;
+    size_t body_size;
+    size_t body_capacity;
+    // * Why it failed, NULL if a whole response came (whatever its status)
+    const char *error;
+    // * Times it was sent and failed or succeeded, 1 without retries
+    size_t attempts;
+} ImHTTP_Batch_Response;
+
+// * Runs on a worker thread, before imhttp_batch_next() can return `index`
+typedef void (*ImHTTP_Batch_Callback)(void *user_data, size_t index, const ImHTTP_Batch_Response *response);
+
+// * Zero fields mean the defaults
+typedef struct {
+    // * Threads, and connections per host:port
+    size_t workers;
+    // * Pipelined GET requests per write. 1 turns pipelining off.
+    size_t pipeline_depth;
+    // * Tries per GET request before it is reported as failed
+    size_t max_attempts;
+    // * Longer bodies fail the request
+    size_t max_body_size;
+    // * How the connections are made, see imhttp_net_connect_addresses()
+    ImHTTP_Net_Options net;
+    // * Optional
+    ImHTTP_Batch_Callback on_complete;
+    void *user_data;
+} ImHTTP_Batch_Options;
+
+typedef struct ImHTTP_Batch_Worker ImHTTP_Batch_Worker;
+
+typedef struct {
+    // * The requests are not copied and must outlive the batch
+    const ImHTTP_Batch_Request *requests;
+    // * Indexed like `requests`. An entry may only be read once its index
+    // * was reported (or after imhttp_batch_wait()).
+    ImHTTP_Batch_Response *responses;
+    size_t count;
+    ImHTTP_Batch_Options options;
+
+    ImHTTP_Batch_Worker *workers;
+    size_t workers_count;
+
+    // * Everything below is guarded by `mutex`
+    pthread_mutex_t mutex;
+    pthread_cond_t completion;
+    // * Indices of the finished requests in the order they finished
+    size_t *completed;
+    size_t completed_count;
+    // * How many of them imhttp_batch_next() handed out
+    size_t reported;
+    // * Failed tries that were given another one. Requests sent again only
+    // * because they were queued behind a failure on the same connection
+    // * are not counted.
+    size_t retries;
+    // * Halves of queues taken over
+    size_t steals;
+} ImHTTP_Batch;
+
+// * Starts the workers and returns right away. Returns false (with nothing
+// * left to free) if out of memory or no thread could be started.
+bool imhttp_batch_start(ImHTTP_Batch *batch, const ImHTTP_Batch_Request *requests, size_t count,
+			const ImHTTP_Batch_Options *options);
+// * Waits for the next finished request. Returns false once all of them
+// * were handed out.
+bool imhttp_batch_next(ImHTTP_Batch *batch, size_t *index);
+// * Waits until every request finished
+void imhttp_batch_wait(ImHTTP_Batch *batch);
+// * Waits for the workers and frees the responses
+void imhttp_batch_free(ImHTTP_Batch *batch);
+
+#endif // * BATCH_H_
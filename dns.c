@@ -0,0 +1,425 @@
+#define _GNU_SOURCE
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include<strings.h>
+#include<errno.h>
+#include<time.h>
+#include<poll.h>
+#include<assert.h>
+
+#include<netdb.h>
+#include<sys/types.h>
+#include<sys/socket.h>
+#include<sys/eventfd.h>
+#include<netinet/in.h>
+#include<arpa/inet.h>
+#include<unistd.h>
+
+#include "./dns.h"
+
+struct ImHTTP_Dns_Waiter {
+    ImHTTP_Dns_Callback callback;
+    void *user_data;
+    ImHTTP_Dns_Waiter *next;
+};
+
+static double dns_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double dns_ttl(const ImHTTP_Dns *dns) {
+    return dns->ttl > 0 ? dns->ttl : IMHTTP_DNS_DEFAULT_TTL;
+}
+
+static double dns_negative_ttl(const ImHTTP_Dns *dns) {
+    return dns->negative_ttl > 0 ? dns->negative_ttl : IMHTTP_DNS_DEFAULT_NEGATIVE_TTL;
+}
+
+// * Default ImHTTP_Dns_Lookup, the same lookup imhttp_net_connect() does
+static bool dns_getaddrinfo(void *user_data, const char *host, const char *port,
+			    ImHTTP_Addresses *addresses, double *ttl) {
+    (void) user_data;
+    (void) ttl;
+    return imhttp_net_resolve(host, port, addresses);
+}
+
+static void dns_signal(ImHTTP_Dns *dns) {
+    uint64_t one = 1;
+    ssize_t n = write(dns->event_fd, &one, sizeof(one));
+    // * Only fails if the counter is about to overflow, it is readable then anyway
+    (void) n;
+}
+
+static void *dns_worker(void *arg) {
+    ImHTTP_Dns *dns = arg;
+
+    pthread_mutex_lock(&dns->mutex);
+    for(;;) {
+	while(dns->queue_count == 0 && !dns->stopping) {
+	    pthread_cond_wait(&dns->work, &dns->mutex);
+	}
+	if(dns->stopping) break;
+
+	// * First come, first served
+	size_t index = dns->queue[0];
+	dns->queue_count -= 1;
+	memmove(dns->queue, dns->queue + 1, dns->queue_count * sizeof(*dns->queue));
+
+	// * `entries` may move while the lock is released
+	char host[IMHTTP_DNS_HOST_CAPACITY];
+	char port[IMHTTP_DNS_PORT_CAPACITY];
+	strcpy(host, dns->entries[index].host);
+	strcpy(port, dns->entries[index].port);
+	ImHTTP_Dns_Lookup lookup = dns->lookup != NULL ? dns->lookup : dns_getaddrinfo;
+	void *lookup_data = dns->lookup_data;
+	double ttl = dns_ttl(dns);
+	dns->lookups += 1;
+	pthread_mutex_unlock(&dns->mutex);
+
+	ImHTTP_Addresses addresses = {0};
+	bool ok = lookup(lookup_data, host, port, &addresses, &ttl);
+
+	pthread_mutex_lock(&dns->mutex);
+	ImHTTP_Dns_Entry *entry = &dns->entries[index];
+	entry->state = ok ? IMHTTP_DNS_ENTRY_RESOLVED : IMHTTP_DNS_ENTRY_FAILED;
+	entry->addresses = addresses;
+	entry->expires_at = dns_now() + (ok ? ttl : dns_negative_ttl(dns));
+	entry->finished = true;
+	dns_signal(dns);
+    }
+    pthread_mutex_unlock(&dns->mutex);
+    return NULL;
+}
+
+static void dns_stop_workers(ImHTTP_Dns *dns) {
+    pthread_mutex_lock(&dns->mutex);
+    dns->stopping = true;
+    pthread_cond_broadcast(&dns->work);
+    pthread_mutex_unlock(&dns->mutex);
+
+    for(size_t i = 0; i < dns->workers_count; ++i) {
+	pthread_join(dns->workers[i], NULL);
+    }
+    dns->workers_count = 0;
+}
+
+bool imhttp_dns_init(ImHTTP_Dns *dns, size_t workers) {
+    memset(dns, 0, sizeof(*dns));
+    if(workers == 0) workers = IMHTTP_DNS_DEFAULT_WORKERS;
+
+    dns->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(dns->event_fd < 0) return false;
+
+    pthread_mutex_init(&dns->mutex, NULL);
+    pthread_cond_init(&dns->work, NULL);
+
+    dns->workers = malloc(workers * sizeof(*dns->workers));
+    if(dns->workers == NULL) {
+	imhttp_dns_free(dns);
+	return false;
+    }
+    for(size_t i = 0; i < workers; ++i) {
+	if(pthread_create(&dns->workers[i], NULL, dns_worker, dns) != 0) {
+	    imhttp_dns_free(dns);
+	    return false;
+	}
+	dns->workers_count += 1;
+    }
+    return true;
+}
+
+void imhttp_dns_free(ImHTTP_Dns *dns) {
+    dns_stop_workers(dns);
+
+    for(size_t i = 0; i < dns->entries_count; ++i) {
+	ImHTTP_Dns_Waiter *waiter = dns->entries[i].waiters;
+	while(waiter != NULL) {
+	    ImHTTP_Dns_Waiter *next = waiter->next;
+	    free(waiter);
+	    waiter = next;
+	}
+    }
+
+    free(dns->workers);
+    free(dns->entries);
+    free(dns->queue);
+    free(dns->statics);
+    close(dns->event_fd);
+    pthread_cond_destroy(&dns->work);
+    pthread_mutex_destroy(&dns->mutex);
+    memset(dns, 0, sizeof(*dns));
+    dns->event_fd = -1;
+}
+
+// * Numeric hosts need no lookup at all
+static bool dns_resolve_numeric(const char *host, const char *port, ImHTTP_Addresses *addresses) {
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+
+    struct addrinfo *addrs;
+    if(getaddrinfo(host, port, &hints, &addrs) != 0) return false;
+    addresses->count = 1;
+    memcpy(&addresses->items[0].addr, addrs->ai_addr, addrs->ai_addrlen);
+    addresses->items[0].addr_len = addrs->ai_addrlen;
+    freeaddrinfo(addrs);
+    return true;
+}
+
+static bool dns_parse_port(const char *port, uint16_t *result) {
+    char *end = NULL;
+    unsigned long value = strtoul(port, &end, 10);
+    if(*port == '\0' || *end != '\0' || value > UINT16_MAX) return false;
+    *result = (uint16_t) value;
+    return true;
+}
+
+static bool dns_resolve_static(ImHTTP_Dns *dns, const char *host, const char *port, ImHTTP_Addresses *addresses) {
+    uint16_t port_number = 0;
+    if(dns->statics_count == 0 || !dns_parse_port(port, &port_number)) return false;
+
+    for(size_t i = 0; i < dns->statics_count; ++i) {
+	if(strcasecmp(dns->statics[i].host, host) != 0) continue;
+
+	*addresses = dns->statics[i].addresses;
+	for(size_t j = 0; j < addresses->count; ++j) {
+	    struct sockaddr_storage *addr = &addresses->items[j].addr;
+	    if(addr->ss_family == AF_INET6) {
+		((struct sockaddr_in6 *) addr)->sin6_port = htons(port_number);
+	    } else {
+		((struct sockaddr_in *) addr)->sin_port = htons(port_number);
+	    }
+	}
+	return true;
+    }
+    return false;
+}
+
+static ImHTTP_Dns_Entry *dns_find_entry(ImHTTP_Dns *dns, const char *host, const char *port) {
+    for(size_t i = 0; i < dns->entries_count; ++i) {
+	ImHTTP_Dns_Entry *entry = &dns->entries[i];
+	if(strcasecmp(entry->host, host) == 0 && strcmp(entry->port, port) == 0) return entry;
+    }
+
+    if(dns->entries_count >= dns->entries_capacity) {
+	size_t new_capacity = dns->entries_capacity == 0 ? 16 : dns->entries_capacity * 2;
+	ImHTTP_Dns_Entry *new_entries = realloc(dns->entries, new_capacity * sizeof(*new_entries));
+	if(new_entries == NULL) return NULL;
+	dns->entries = new_entries;
+	dns->entries_capacity = new_capacity;
+    }
+
+    // * Entries are never removed, the workers refer to them by index
+    ImHTTP_Dns_Entry *entry = &dns->entries[dns->entries_count++];
+    memset(entry, 0, sizeof(*entry));
+    strcpy(entry->host, host);
+    strcpy(entry->port, port);
+    entry->state = IMHTTP_DNS_ENTRY_FAILED;
+    return entry;
+}
+
+static bool dns_enqueue(ImHTTP_Dns *dns, size_t index) {
+    if(dns->queue_count >= dns->queue_capacity) {
+	size_t new_capacity = dns->queue_capacity == 0 ? 16 : dns->queue_capacity * 2;
+	size_t *new_queue = realloc(dns->queue, new_capacity * sizeof(*new_queue));
+	if(new_queue == NULL) return false;
+	dns->queue = new_queue;
+	dns->queue_capacity = new_capacity;
+    }
+    dns->queue[dns->queue_count++] = index;
+    pthread_cond_signal(&dns->work);
+    return true;
+}
+
+// * With the lock held
+static ImHTTP_Dns_Status dns_resolve_cached(ImHTTP_Dns *dns, const char *host, const char *port,
+					    ImHTTP_Addresses *addresses,
+					    ImHTTP_Dns_Callback callback, void *user_data) {
+    ImHTTP_Dns_Entry *entry = dns_find_entry(dns, host, port);
+    if(entry == NULL) return IMHTTP_DNS_FAILED;
+
+    if(entry->state != IMHTTP_DNS_ENTRY_RESOLVING && dns_now() < entry->expires_at) {
+	if(entry->state != IMHTTP_DNS_ENTRY_RESOLVED) return IMHTTP_DNS_FAILED;
+	*addresses = entry->addresses;
+	return IMHTTP_DNS_DONE;
+    }
+
+    ImHTTP_Dns_Waiter *waiter = malloc(sizeof(*waiter));
+    if(waiter == NULL) return IMHTTP_DNS_FAILED;
+
+    // * Whoever asks while the lookup is in flight just waits for it too
+    if(entry->state != IMHTTP_DNS_ENTRY_RESOLVING) {
+	if(!dns_enqueue(dns, entry - dns->entries)) {
+	    free(waiter);
+	    return IMHTTP_DNS_FAILED;
+	}
+	entry->state = IMHTTP_DNS_ENTRY_RESOLVING;
+    }
+
+    waiter->callback = callback;
+    waiter->user_data = user_data;
+    waiter->next = entry->waiters;
+    entry->waiters = waiter;
+    return IMHTTP_DNS_PENDING;
+}
+
+ImHTTP_Dns_Status imhttp_dns_resolve(ImHTTP_Dns *dns, const char *host, const char *port,
+				     ImHTTP_Addresses *addresses,
+				     ImHTTP_Dns_Callback callback, void *user_data) {
+    if(dns_resolve_numeric(host, port, addresses)) return IMHTTP_DNS_DONE;
+    if(dns_resolve_static(dns, host, port, addresses)) return IMHTTP_DNS_DONE;
+    if(dns->offline) return IMHTTP_DNS_FAILED;
+    if(strlen(host) >= IMHTTP_DNS_HOST_CAPACITY || strlen(port) >= IMHTTP_DNS_PORT_CAPACITY) {
+	return IMHTTP_DNS_FAILED;
+    }
+
+    pthread_mutex_lock(&dns->mutex);
+    ImHTTP_Dns_Status status = dns_resolve_cached(dns, host, port, addresses, callback, user_data);
+    pthread_mutex_unlock(&dns->mutex);
+    return status;
+}
+
+size_t imhttp_dns_dispatch(ImHTTP_Dns *dns) {
+    uint64_t value;
+    ssize_t n = read(dns->event_fd, &value, sizeof(value));
+    (void) n;
+
+    size_t ran = 0;
+    pthread_mutex_lock(&dns->mutex);
+    // * By index, the callbacks may add entries
+    for(size_t i = 0; i < dns->entries_count; ++i) {
+	ImHTTP_Dns_Entry *entry = &dns->entries[i];
+	if(!entry->finished) continue;
+	entry->finished = false;
+
+	ImHTTP_Addresses addresses = entry->addresses;
+	bool ok = entry->state == IMHTTP_DNS_ENTRY_RESOLVED;
+
+	// * They were pushed to the front, so reverse them into asking order
+	ImHTTP_Dns_Waiter *waiters = NULL;
+	while(entry->waiters != NULL) {
+	    ImHTTP_Dns_Waiter *waiter = entry->waiters;
+	    entry->waiters = waiter->next;
+	    waiter->next = waiters;
+	    waiters = waiter;
+	}
+
+	pthread_mutex_unlock(&dns->mutex);
+	while(waiters != NULL) {
+	    ImHTTP_Dns_Waiter *waiter = waiters;
+	    waiters = waiter->next;
+	    waiter->callback(waiter->user_data, ok ? &addresses : NULL);
+	    free(waiter);
+	    ran += 1;
+	}
+	pthread_mutex_lock(&dns->mutex);
+    }
+    pthread_mutex_unlock(&dns->mutex);
+    return ran;
+}
+
+typedef struct {
+    bool done;
+    bool ok;
+    ImHTTP_Addresses *addresses;
+} Dns_Wait;
+
+static void dns_wait_done(void *user_data, const ImHTTP_Addresses *addresses) {
+    Dns_Wait *wait = user_data;
+    wait->done = true;
+    wait->ok = addresses != NULL;
+    if(addresses != NULL) *wait->addresses = *addresses;
+}
+
+bool imhttp_dns_resolve_wait(ImHTTP_Dns *dns, const char *host, const char *port, ImHTTP_Addresses *addresses) {
+    Dns_Wait wait = { .addresses = addresses };
+    switch(imhttp_dns_resolve(dns, host, port, addresses, dns_wait_done, &wait)) {
+    case IMHTTP_DNS_DONE:    return true;
+    case IMHTTP_DNS_FAILED:  return false;
+    case IMHTTP_DNS_PENDING: break;
+    default:
+	assert(0 && "imhttp_dns_resolve_wait: unreachable");
+    }
+
+    while(!wait.done) {
+	struct pollfd pfd = { .fd = dns->event_fd, .events = POLLIN };
+	if(poll(&pfd, 1, -1) < 0 && errno != EINTR) return false;
+	imhttp_dns_dispatch(dns);
+    }
+    return wait.ok;
+}
+
+bool imhttp_dns_add_static(ImHTTP_Dns *dns, const char *host, const char *address) {
+    if(strlen(host) >= IMHTTP_DNS_HOST_CAPACITY) return false;
+
+    ImHTTP_Address parsed = {0};
+    struct sockaddr_in *in = (struct sockaddr_in *) &parsed.addr;
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) &parsed.addr;
+    if(inet_pton(AF_INET, address, &in->sin_addr) == 1) {
+	in->sin_family = AF_INET;
+	parsed.addr_len = sizeof(*in);
+    } else if(inet_pton(AF_INET6, address, &in6->sin6_addr) == 1) {
+	in6->sin6_family = AF_INET6;
+	parsed.addr_len = sizeof(*in6);
+    } else {
+	return false;
+    }
+
+    ImHTTP_Dns_Static *entry = NULL;
+    for(size_t i = 0; i < dns->statics_count && entry == NULL; ++i) {
+	if(strcasecmp(dns->statics[i].host, host) == 0) entry = &dns->statics[i];
+    }
+    if(entry == NULL) {
+	if(dns->statics_count >= dns->statics_capacity) {
+	    size_t new_capacity = dns->statics_capacity == 0 ? 16 : dns->statics_capacity * 2;
+	    ImHTTP_Dns_Static *new_statics = realloc(dns->statics, new_capacity * sizeof(*new_statics));
+	    if(new_statics == NULL) return false;
+	    dns->statics = new_statics;
+	    dns->statics_capacity = new_capacity;
+	}
+	entry = &dns->statics[dns->statics_count++];
+	memset(entry, 0, sizeof(*entry));
+	strcpy(entry->host, host);
+    }
+
+    if(entry->addresses.count >= IMHTTP_NET_MAX_ADDRESSES) return false;
+    entry->addresses.items[entry->addresses.count++] = parsed;
+    return true;
+}
+
+bool imhttp_dns_load_hosts(ImHTTP_Dns *dns, const char *path) {
+    FILE *f = fopen(path, "r");
+    if(f == NULL) return false;
+
+    char line[1024];
+    while(fgets(line, sizeof(line), f) != NULL) {
+	char *comment = strchr(line, '#');
+	if(comment != NULL) *comment = '\0';
+
+	char *saveptr = NULL;
+	const char *address = strtok_r(line, " \t\r\n", &saveptr);
+	if(address == NULL) continue;
+	// * Lines that don't start with an address are skipped as a whole
+	for(const char *name; (name = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL; ) {
+	    if(!imhttp_dns_add_static(dns, name, address)) break;
+	}
+    }
+
+    fclose(f);
+    return true;
+}
+
+void imhttp_dns_flush(ImHTTP_Dns *dns) {
+    pthread_mutex_lock(&dns->mutex);
+    for(size_t i = 0; i < dns->entries_count; ++i) {
+	dns->entries[i].expires_at = 0;
+    }
+    pthread_mutex_unlock(&dns->mutex);
+}
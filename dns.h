@@ -0,0 +1,133 @@
+#ifndef DNS_H_
+#define DNS_H_
+
+#include<stdbool.h>
+#include<stddef.h>
+#include<pthread.h>
+
+#include "./net.h"
+
+// * Caching asynchronous resolver.
+// *
+// * Answers are cached per host:port for `ttl` seconds (failures for
+// * `negative_ttl`). A name that is not cached is looked up on one of the
+// * worker threads, and concurrent requests for it all wait on that single
+// * lookup. Finished lookups make `event_fd` readable; imhttp_dns_dispatch()
+// * then runs the callbacks on the calling thread, so an event loop only has
+// * to watch one more descriptor and never blocks on DNS.
+// *
+// * Numeric addresses never reach the workers. Names added with
+// * imhttp_dns_add_static() or imhttp_dns_load_hosts() never expire and are
+// * answered before anything else. With `offline` set nothing else is looked
+// * up, which together with those (or a custom `lookup`) makes tests
+// * independent of the network.
+// *
+// * imhttp_dns_resolve() and imhttp_dns_dispatch() must be called from one
+// * thread at a time.
+
+#define IMHTTP_DNS_HOST_CAPACITY 256
+#define IMHTTP_DNS_PORT_CAPACITY 16
+#define IMHTTP_DNS_DEFAULT_WORKERS 2
+#define IMHTTP_DNS_DEFAULT_TTL 60.0
+#define IMHTTP_DNS_DEFAULT_NEGATIVE_TTL 5.0
+
+// * Runs on a worker thread. `ttl` comes preset to the resolver's `ttl` and
+// * may be lowered (or raised) to what the answer allows.
+typedef bool (*ImHTTP_Dns_Lookup)(void *user_data, const char *host, const char *port,
+				  ImHTTP_Addresses *addresses, double *ttl);
+
+// * `addresses` is NULL if the name did not resolve. Valid during the call only.
+typedef void (*ImHTTP_Dns_Callback)(void *user_data, const ImHTTP_Addresses *addresses);
+
+typedef enum {
+    // * Answered from the cache, `addresses` is filled in and the callback is not called
+    IMHTTP_DNS_DONE,
+    // * The callback runs from a later imhttp_dns_dispatch()
+    IMHTTP_DNS_PENDING,
+    // * Known not to resolve (or out of memory), the callback is not called
+    IMHTTP_DNS_FAILED,
+} ImHTTP_Dns_Status;
+
+typedef struct ImHTTP_Dns_Waiter ImHTTP_Dns_Waiter;
+
+typedef enum {
+    IMHTTP_DNS_ENTRY_RESOLVING,
+    IMHTTP_DNS_ENTRY_RESOLVED,
+    IMHTTP_DNS_ENTRY_FAILED,
+} ImHTTP_Dns_Entry_State;
+
+typedef struct {
+    char host[IMHTTP_DNS_HOST_CAPACITY];
+    char port[IMHTTP_DNS_PORT_CAPACITY];
+    ImHTTP_Dns_Entry_State state;
+    ImHTTP_Addresses addresses;
+    double expires_at;
+    // * Callbacks waiting for the lookup in flight
+    ImHTTP_Dns_Waiter *waiters;
+    // * The lookup finished and the waiters were not dispatched yet
+    bool finished;
+} ImHTTP_Dns_Entry;
+
+typedef struct {
+    char host[IMHTTP_DNS_HOST_CAPACITY];
+    // * The port is filled in per request
+    ImHTTP_Addresses addresses;
+} ImHTTP_Dns_Static;
+
+typedef struct {
+    // * Settings, may be changed after imhttp_dns_init(). Zero means the default.
+    double ttl;
+    double negative_ttl;
+    bool offline;
+    // * getaddrinfo() if NULL
+    ImHTTP_Dns_Lookup lookup;
+    void *lookup_data;
+
+    // * Readable when imhttp_dns_dispatch() has callbacks to run
+    int event_fd;
+
+    // * Everything below is guarded by `mutex`
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+    pthread_t *workers;
+    size_t workers_count;
+    bool stopping;
+
+    ImHTTP_Dns_Entry *entries;
+    size_t entries_count;
+    size_t entries_capacity;
+
+    // * Entries waiting for a worker, by index
+    size_t *queue;
+    size_t queue_count;
+    size_t queue_capacity;
+
+    ImHTTP_Dns_Static *statics;
+    size_t statics_count;
+    size_t statics_capacity;
+
+    // * Lookups actually made, for tests and stats
+    size_t lookups;
+} ImHTTP_Dns;
+
+// * `workers` 0 means IMHTTP_DNS_DEFAULT_WORKERS
+bool imhttp_dns_init(ImHTTP_Dns *dns, size_t workers);
+// * Stops the workers. Pending callbacks are dropped without being called.
+void imhttp_dns_free(ImHTTP_Dns *dns);
+
+ImHTTP_Dns_Status imhttp_dns_resolve(ImHTTP_Dns *dns, const char *host, const char *port,
+				     ImHTTP_Addresses *addresses,
+				     ImHTTP_Dns_Callback callback, void *user_data);
+// * Runs the callbacks of the finished lookups. Returns how many ran.
+size_t imhttp_dns_dispatch(ImHTTP_Dns *dns);
+// * Blocking convenience on top of the above
+bool imhttp_dns_resolve_wait(ImHTTP_Dns *dns, const char *host, const char *port, ImHTTP_Addresses *addresses);
+
+// * `address` must be numeric (IPv4 or IPv6). A name can get several.
+bool imhttp_dns_add_static(ImHTTP_Dns *dns, const char *host, const char *address);
+// * Adds every entry of a hosts(5) file as static. Returns false if it can't be read.
+bool imhttp_dns_load_hosts(ImHTTP_Dns *dns, const char *path);
+// * Forgets all the cached answers (static names stay)
+void imhttp_dns_flush(ImHTTP_Dns *dns);
+
+#endif // * DNS_H_
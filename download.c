@@ -0,0 +1,443 @@
+#define _GNU_SOURCE
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<pthread.h>
+#include<assert.h>
+
+#include<sys/types.h>
+#include<unistd.h>
+
+#include "./download.h"
+
+// * [begin, end) of the resource. `begin` moves as bytes are written, `end`
+// * comes down when another connection takes over the second half.
+typedef struct {
+    uint64_t begin;
+    uint64_t end;
+    // * Failed tries so far
+    size_t attempts;
+} Download_Piece;
+
+typedef struct Download Download;
+
+typedef struct {
+    Download *download;
+    pthread_t thread;
+    bool thread_started;
+    ImHTTP imhttp;
+    // * -1 while not connected
+    int sd;
+    // * Guarded by download->mutex
+    Download_Piece piece;
+    bool busy;
+} Download_Worker;
+
+struct Download {
+    const char *host;
+    const char *port;
+    const char *resource;
+    int fd;
+    ImHTTP_Download_Options options;
+    ImHTTP_Addresses addresses;
+
+    // * Everything below is guarded by `mutex`
+    pthread_mutex_t mutex;
+    uint64_t size;
+    // * Where the part that was never handed out starts
+    uint64_t next;
+    // * Pieces waiting to be tried again. Only busy workers add to it, so
+    // * it never holds more than one piece per worker.
+    Download_Piece retry[IMHTTP_DOWNLOAD_MAX_CONNECTIONS];
+    size_t retry_count;
+    Download_Worker workers[IMHTTP_DOWNLOAD_MAX_CONNECTIONS];
+    size_t workers_count;
+    ImHTTP_Download_Result result;
+};
+
+static void download_options_defaults(ImHTTP_Download_Options *options) {
+    if(options->connections == 0) options->connections = IMHTTP_DOWNLOAD_DEFAULT_CONNECTIONS;
+    if(options->connections > IMHTTP_DOWNLOAD_MAX_CONNECTIONS) options->connections = IMHTTP_DOWNLOAD_MAX_CONNECTIONS;
+    if(options->segment_size == 0) options->segment_size = IMHTTP_DOWNLOAD_DEFAULT_SEGMENT_SIZE;
+    if(options->min_split == 0) options->min_split = IMHTTP_DOWNLOAD_DEFAULT_MIN_SPLIT;
+    if(options->max_attempts == 0) options->max_attempts = IMHTTP_DOWNLOAD_DEFAULT_MAX_ATTEMPTS;
+    if(options->config.body_capacity == 0) options->config.body_capacity = IMHTTP_BULK_READ_SIZE;
+}
+
+static bool download_pwrite_all(int fd, const char *data, size_t size, uint64_t offset) {
+    while(size > 0) {
+	ssize_t n = pwrite(fd, data, size, (off_t) offset);
+	if(n < 0 && errno == EINTR) continue;
+	if(n <= 0) return false;
+	data += n;
+	size -= n;
+	offset += n;
+    }
+    return true;
+}
+
+// * Stops everyone. The first reason sticks.
+static void download_fail_locked(Download *download, const char *error) {
+    if(download->result.error == NULL) download->result.error = error;
+}
+
+static void download_disconnect(Download_Worker *worker) {
+    if(worker->sd < 0) return;
+    close(worker->sd);
+    imhttp_free(&worker->imhttp);
+    worker->sd = -1;
+}
+
+static bool download_connect(Download *download, Download_Worker *worker) {
+    if(worker->sd >= 0) return true;
+    worker->sd = imhttp_net_connect_addresses(&download->addresses, &download->options.net);
+    if(worker->sd < 0) return false;
+    imhttp_init(&worker->imhttp, &download->options.config);
+    imhttp_net_attach(&worker->imhttp, worker->sd);
+
+    pthread_mutex_lock(&download->mutex);
+    download->result.connections += 1;
+    pthread_mutex_unlock(&download->mutex);
+    return true;
+}
+
+// * "bytes <first>-<last>/<size>". `size` is UINT64_MAX for "*".
+static bool download_parse_content_range(String_View value, uint64_t *first, uint64_t *last, uint64_t *size) {
+    sv_trim(&value);
+    String_View unit = sv_chop_by_delim(&value, ' ');
+    if(!sv_eq_ignorecase(unit, cstr_to_sv("bytes"))) return false;
+    sv_trim(&value);
+
+    String_View range = sv_chop_by_delim(&value, '/');
+    if(sv_eq(value, cstr_to_sv("*"))) {
+	*size = UINT64_MAX;
+    } else if(sv_parse_u64(value, size) != SV_PARSE_OK) {
+	return false;
+    }
+    // * "*/<size>" comes with 416
+    if(sv_eq(range, cstr_to_sv("*"))) {
+	*first = UINT64_MAX;
+	*last = UINT64_MAX;
+	return true;
+    }
+
+    String_View first_sv = sv_chop_by_delim(&range, '-');
+    return sv_parse_u64(first_sv, first) == SV_PARSE_OK
+	&& sv_parse_u64(range, last) == SV_PARSE_OK
+	&& *first <= *last;
+}
+
+// * Why download_request() failed
+static const char *download_request_error(const ImHTTP *imhttp) {
+    if(imhttp->req_error != NULL) return imhttp->req_error;
+    if(imhttp->res_error != NULL) return imhttp->res_error;
+    return "Invalid Content-Range";
+}
+
+// * Sends the Range request for `piece` and reads the headers. Content-Range
+// * goes into `first`, `last` and `size` (all UINT64_MAX if there was none).
+static bool download_request(Download *download, Download_Worker *worker, Download_Piece piece,
+			     uint64_t *first, uint64_t *last, uint64_t *size) {
+    char range[64];
+    snprintf(range, sizeof(range), "bytes=%llu-%llu",
+	     (unsigned long long) piece.begin, (unsigned long long) piece.end - 1);
+
+    ImHTTP *imhttp = &worker->imhttp;
+    imhttp_req_begin(imhttp, IMHTTP_GET, download->resource);
+    imhttp_req_header(imhttp, "Host", download->host);
+    imhttp_req_header(imhttp, "Range", range);
+    imhttp_req_headers_end(imhttp);
+    if(!imhttp_req_end(imhttp)) return false;
+
+    *first = UINT64_MAX;
+    *last = UINT64_MAX;
+    *size = UINT64_MAX;
+    imhttp_res_begin(imhttp);
+    imhttp_res_status_code(imhttp);
+    String_View name, value;
+    while(imhttp_res_next_header(imhttp, &name, &value)) {
+	if(imhttp_header_lookup(name) == IMHTTP_HDR_CONTENT_RANGE
+	   && !download_parse_content_range(value, first, last, size)) {
+	    return false;
+	}
+    }
+    return imhttp->res_error == NULL;
+}
+
+// * Writes the body of the response to the piece `worker` is on. Returns
+// * false if the piece has to be tried again.
+static bool download_receive(Download *download, Download_Worker *worker, const char **error) {
+    ImHTTP *imhttp = &worker->imhttp;
+    String_View chunk;
+    while(imhttp_res_next_body_chunk(imhttp, &chunk)) {
+	pthread_mutex_lock(&download->mutex);
+	const uint64_t begin = worker->piece.begin;
+	const uint64_t end = worker->piece.end;
+	pthread_mutex_unlock(&download->mutex);
+
+	// * Past a lowered `end` the bytes belong to whoever took over
+	size_t useful = chunk.count;
+	if(useful > end - begin) useful = end - begin;
+	if(!download_pwrite_all(download->fd, chunk.data, useful, begin)) {
+	    pthread_mutex_lock(&download->mutex);
+	    download_fail_locked(download, "Could not write the file");
+	    pthread_mutex_unlock(&download->mutex);
+	    return true;
+	}
+
+	pthread_mutex_lock(&download->mutex);
+	worker->piece.begin += useful;
+	const bool done = worker->piece.begin >= worker->piece.end;
+	pthread_mutex_unlock(&download->mutex);
+
+	if(done) {
+	    if(imhttp->content_length == 0) {
+		imhttp_res_end(imhttp);
+		if(!imhttp->keep_alive) download_disconnect(worker);
+	    } else {
+		// * The rest of the response is not wanted anymore
+		download_disconnect(worker);
+	    }
+	    return true;
+	}
+    }
+
+    *error = imhttp->res_error != NULL ? imhttp->res_error : "The server sent less than asked for";
+    return false;
+}
+
+static bool download_fetch(Download *download, Download_Worker *worker, const char **error) {
+    if(!download_connect(download, worker)) {
+	*error = "Could not connect";
+	return false;
+    }
+
+    pthread_mutex_lock(&download->mutex);
+    const Download_Piece piece = worker->piece;
+    pthread_mutex_unlock(&download->mutex);
+
+    uint64_t first, last, size;
+    if(!download_request(download, worker, piece, &first, &last, &size)) {
+	*error = download_request_error(&worker->imhttp);
+	return false;
+    }
+    if(worker->imhttp.status_code != 206) {
+	*error = "The server did not answer the Range request with 206";
+	return false;
+    }
+    if(first != piece.begin || last < piece.end - 1 || size != download->size) {
+	*error = "The server sent another range than asked for";
+	return false;
+    }
+    return download_receive(download, worker, error);
+}
+
+// * Gives `worker` its next piece: a failed one, a new one or the second half
+// * of the biggest one in flight. Returns false when there is nothing left.
+static bool download_take_locked(Download *download, Download_Worker *worker) {
+    if(download->result.error != NULL) return false;
+
+    if(download->retry_count > 0) {
+	worker->piece = download->retry[--download->retry_count];
+    } else if(download->next < download->size) {
+	uint64_t left = download->size - download->next;
+	uint64_t count = left < download->options.segment_size ? left : download->options.segment_size;
+	worker->piece = (Download_Piece) { .begin = download->next, .end = download->next + count };
+	download->next += count;
+    } else {
+	Download_Worker *victim = NULL;
+	for(size_t i = 0; i < download->workers_count; ++i) {
+	    Download_Worker *other = &download->workers[i];
+	    if(other == worker || !other->busy) continue;
+	    if(victim == NULL || other->piece.end - other->piece.begin > victim->piece.end - victim->piece.begin) {
+		victim = other;
+	    }
+	}
+	if(victim == NULL || victim->piece.end - victim->piece.begin < 2 * download->options.min_split) {
+	    return false;
+	}
+	uint64_t middle = victim->piece.begin + (victim->piece.end - victim->piece.begin) / 2;
+	worker->piece = (Download_Piece) { .begin = middle, .end = victim->piece.end };
+	victim->piece.end = middle;
+	download->result.splits += 1;
+    }
+
+    worker->busy = true;
+    download->result.requests += 1;
+    return true;
+}
+
+static void download_piece_failed(Download *download, Download_Worker *worker, const char *error) {
+    download_disconnect(worker);
+
+    pthread_mutex_lock(&download->mutex);
+    Download_Piece piece = worker->piece;
+    worker->busy = false;
+    piece.attempts += 1;
+    if(piece.begin >= piece.end) {
+	// * Everything it still had to do was taken over
+    } else if(piece.attempts >= download->options.max_attempts) {
+	download_fail_locked(download, error);
+    } else {
+	assert(download->retry_count < IMHTTP_DOWNLOAD_MAX_CONNECTIONS);
+	download->retry[download->retry_count++] = piece;
+	download->result.retries += 1;
+    }
+    pthread_mutex_unlock(&download->mutex);
+}
+
+static void download_work(Download_Worker *worker, bool receiving) {
+    Download *download = worker->download;
+    for(;;) {
+	const char *error = NULL;
+	// * The first worker starts in the middle of the first response
+	bool ok = receiving ? download_receive(download, worker, &error) : download_fetch(download, worker, &error);
+	receiving = false;
+	if(ok) {
+	    pthread_mutex_lock(&download->mutex);
+	    worker->busy = false;
+	    pthread_mutex_unlock(&download->mutex);
+	} else {
+	    download_piece_failed(download, worker, error);
+	}
+
+	pthread_mutex_lock(&download->mutex);
+	bool more = download_take_locked(download, worker);
+	pthread_mutex_unlock(&download->mutex);
+	if(!more) break;
+    }
+    download_disconnect(worker);
+}
+
+static void *download_worker_thread(void *arg) {
+    Download_Worker *worker = arg;
+    // * Starts idle and goes straight for a piece
+    pthread_mutex_lock(&worker->download->mutex);
+    bool more = download_take_locked(worker->download, worker);
+    pthread_mutex_unlock(&worker->download->mutex);
+    if(more) download_work(worker, false);
+    return NULL;
+}
+
+// * The server ignored Range: the whole body comes over the first connection
+static bool download_whole(Download *download, Download_Worker *worker) {
+    ImHTTP *imhttp = &worker->imhttp;
+    uint64_t offset = 0;
+    String_View chunk;
+    while(imhttp_res_next_body_chunk(imhttp, &chunk)) {
+	if(!download_pwrite_all(download->fd, chunk.data, chunk.count, offset)) {
+	    download_fail_locked(download, "Could not write the file");
+	    return false;
+	}
+	offset += chunk.count;
+    }
+    if(imhttp->res_error != NULL) {
+	download_fail_locked(download, imhttp->res_error);
+	return false;
+    }
+    imhttp_res_end(imhttp);
+    download->size = offset;
+    return true;
+}
+
+// * Asks for the first segment and learns the size from the answer. Returns
+// * true if the rest can be fetched in parallel, `download->size` is set then.
+static bool download_probe(Download *download, Download_Worker *worker) {
+    if(!download_connect(download, worker)) {
+	download_fail_locked(download, "Could not connect");
+	return false;
+    }
+
+    Download_Piece piece = { .begin = 0, .end = download->options.segment_size };
+    uint64_t first, last, size;
+    download->result.requests += 1;
+    if(!download_request(download, worker, piece, &first, &last, &size)) {
+	download_fail_locked(download, download_request_error(&worker->imhttp));
+	return false;
+    }
+
+    switch(worker->imhttp.status_code) {
+    case 200:
+	download_whole(download, worker);
+	return false;
+
+    case 206:
+	if(size == UINT64_MAX || first != 0 || last >= size) {
+	    download_fail_locked(download, "The server did not tell the size of the resource");
+	    return false;
+	}
+	download->size = size;
+	download->next = last + 1;
+	worker->piece = (Download_Piece) { .begin = 0, .end = last + 1 };
+	worker->busy = true;
+	return true;
+
+    case 416:
+	// * Nothing satisfies a range of an empty resource
+	if(size == 0) {
+	    imhttp_res_end(&worker->imhttp);
+	    download->size = 0;
+	    return false;
+	}
+	download_fail_locked(download, "The server refused the range");
+	return false;
+
+    default:
+	download_fail_locked(download, "The server did not answer with 200 or 206");
+	return false;
+    }
+}
+
+bool imhttp_download(const char *host, const char *port, const char *resource, int fd,
+		     const ImHTTP_Download_Options *options, ImHTTP_Download_Result *result) {
+    Download *download = calloc(1, sizeof(*download));
+    if(download == NULL) {
+	if(result != NULL) *result = (ImHTTP_Download_Result) { .error = "Out of memory" };
+	return false;
+    }
+    download->host = host;
+    download->port = port;
+    download->resource = resource;
+    download->fd = fd;
+    if(options != NULL) download->options = *options;
+    download_options_defaults(&download->options);
+    pthread_mutex_init(&download->mutex, NULL);
+    for(size_t i = 0; i < IMHTTP_DOWNLOAD_MAX_CONNECTIONS; ++i) {
+	download->workers[i].download = download;
+	download->workers[i].sd = -1;
+    }
+
+    Download_Worker *first = &download->workers[0];
+    download->workers_count = 1;
+    if(!imhttp_net_resolve(host, port, &download->addresses)) {
+	download_fail_locked(download, "Could not resolve the host");
+    } else if(download_probe(download, first)) {
+	// * More connections than min_split sized halves would only sit around
+	uint64_t useful = download->size / download->options.min_split;
+	size_t count = download->options.connections;
+	if(useful < count) count = useful > 0 ? useful : 1;
+
+	for(size_t i = 1; i < count; ++i) {
+	    Download_Worker *worker = &download->workers[i];
+	    pthread_mutex_lock(&download->mutex);
+	    download->workers_count = i + 1;
+	    pthread_mutex_unlock(&download->mutex);
+	    worker->thread_started = pthread_create(&worker->thread, NULL, download_worker_thread, worker) == 0;
+	    if(!worker->thread_started) break;
+	}
+	download_work(first, true);
+	for(size_t i = 1; i < download->workers_count; ++i) {
+	    if(download->workers[i].thread_started) pthread_join(download->workers[i].thread, NULL);
+	}
+    }
+    download_disconnect(first);
+
+    download->result.size = download->size;
+    bool ok = download->result.error == NULL;
+    if(result != NULL) *result = download->result;
+    pthread_mutex_destroy(&download->mutex);
+    free(download);
+    return ok;
+}
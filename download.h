@@ -0,0 +1,66 @@
+#ifndef DOWNLOAD_H_
+#define DOWNLOAD_H_
+
+#include<stdbool.h>
+#include<stddef.h>
+#include<stdint.h>
+
+#include "./imhttp.h"
+#include "./net.h"
+
+// * Parallel ranged download of one resource into a file.
+// *
+// * The first request asks for the first segment with a Range header. A 206
+// * answer tells the size of the whole resource (Content-Range), and the rest
+// * is split into segments fetched over `connections` keep-alive connections
+// * at once, one thread each. Every segment is written with pwrite() at its
+// * offset, so the file offset of `fd` is left alone and the segments can
+// * land in any order. A server that ignores Range (200) gets the whole body
+// * over the first connection instead.
+// *
+// * A segment that fails (connection lost, error status, short body) is
+// * retried from where it stopped on a new connection, up to `max_attempts`
+// * times. Connections that run out of segments take over the second half of
+// * the biggest remainder still in flight, so one slow connection does not
+// * hold up the end of the download. The connection that was relieved drops
+// * the rest of its response once it reaches the new end of its segment.
+
+#define IMHTTP_DOWNLOAD_DEFAULT_CONNECTIONS 4
+#define IMHTTP_DOWNLOAD_DEFAULT_SEGMENT_SIZE (8 * 1024 * 1024)
+#define IMHTTP_DOWNLOAD_DEFAULT_MIN_SPLIT (1024 * 1024)
+#define IMHTTP_DOWNLOAD_DEFAULT_MAX_ATTEMPTS 3
+#define IMHTTP_DOWNLOAD_MAX_CONNECTIONS 64
+
+// * Zero fields mean the defaults
+typedef struct {
+    size_t connections;
+    // * Bytes asked for per Range request
+    uint64_t segment_size;
+    // * Remainders are only split if both halves get at least that much
+    uint64_t min_split;
+    // * Tries per piece of the resource before the download fails
+    size_t max_attempts;
+    // * How the connections are made, see imhttp_net_connect_addresses()
+    ImHTTP_Net_Options net;
+    // * For every connection. body_capacity is IMHTTP_BULK_READ_SIZE by default.
+    ImHTTP_Config config;
+} ImHTTP_Download_Options;
+
+typedef struct {
+    // * Size of the resource
+    uint64_t size;
+    // * Range requests made, retries and stolen halves included
+    size_t requests;
+    size_t retries;
+    size_t splits;
+    size_t connections;
+    // * Why it failed, NULL on success
+    const char *error;
+} ImHTTP_Download_Result;
+
+// * Downloads http://host:port`resource` into `fd` starting at offset 0.
+// * The file is not truncated. `options` and `result` may be NULL.
+bool imhttp_download(const char *host, const char *port, const char *resource, int fd,
+		     const ImHTTP_Download_Options *options, ImHTTP_Download_Result *result);
+
+#endif // * DOWNLOAD_H_
@@ -3,6 +3,12 @@
 #define IMHTTP_H_
 
 #include<assert.h>
+#include<errno.h>
+#include<stdatomic.h>
+
+#ifdef IMHTTP_ZLIB
+#include<zlib.h>
+#endif
 
 #include "./sv.h"
 
@@ -13,54 +19,630 @@ typedef void* ImHTTP_Socket;
 typedef ssize_t (*ImHTTP_Write)(ImHTTP_Socket socket, const void *buf, size_t count);
 typedef ssize_t (*ImHTTP_Read)(ImHTTP_Socket socket, void *buf, size_t count);
 
+// * Layout compatible with `struct iovec` so writev(2) can be plugged in directly
+typedef struct {
+    const void *base;
+    size_t len;
+} ImHTTP_Iovec;
+
+// * Optional. When provided, large body chunks are sent together with the
+// * staged request bytes in a single call instead of being copied.
+typedef ssize_t (*ImHTTP_Writev)(ImHTTP_Socket socket, const ImHTTP_Iovec *iov, int iovcnt);
+
+// * Optional. Sends up to `count` bytes of the file `in_fd` from `*offset`
+// * without them passing through user memory, and advances `*offset` by what
+// * was sent (sendfile(2) semantics). Failing with EINVAL, ESPIPE or ENOSYS
+// * before anything was sent makes imhttp_req_body_file() read the file instead.
+typedef ssize_t (*ImHTTP_Sendfile)(ImHTTP_Socket socket, int in_fd, int64_t *offset, size_t count);
+
+// * Optional. Moves up to `count` bytes from the socket into `out_fd`
+// * without them passing through user memory and returns how many were
+// * moved, 0 at the end of the stream. Failing with EINVAL before anything
+// * was taken from the socket makes imhttp_res_body_to_fd() copy instead.
+typedef ssize_t (*ImHTTP_Splice)(ImHTTP_Socket socket, int out_fd, size_t count);
+
 typedef enum {
     IMHTTP_GET,
     IMHTTP_POST,
 } ImHTTP_Method;
 
 #define IMHTTP_ROLLIN_BUFFER_CAPACITY (8 * 1024)
-#define IMHTTP_USER_BUFFER_CAPACITY IMHTTP_ROLLIN_BUFFER_CAPACITY
+#define IMHTTP_ROLLIN_BUFFER_MAX_CAPACITY (64 * 1024)
+#define IMHTTP_REQ_BUFFER_CAPACITY (4 * 1024)
+// * Suggested ImHTTP_Config.body_capacity for bulk downloads
+#define IMHTTP_BULK_READ_SIZE (256 * 1024)
+
+// * realloc() that also gets the old size, so arenas can be plugged in:
+// * ptr == NULL allocates, new_size == 0 frees.
+typedef struct {
+    void *(*resize)(void *user_data, void *ptr, size_t old_size, size_t new_size);
+    void *user_data;
+} ImHTTP_Allocator;
+
+// * Lock-free pool of equally sized receive buffers, meant to be shared by
+// * every connection of the process (see ImHTTP_Config.rollin_pool).
+// * All the buffers come from one slab allocated up front. The free list
+// * is a Treiber stack of slab indices, with an ABA tag next to the index.
+typedef struct {
+    char *slab;
+    size_t buffer_size;
+    uint32_t count;
+    // * Next free buffer after every buffer on the free list
+    _Atomic uint32_t *next;
+    // * Index of the first free buffer in the low 32 bits, tag in the high ones
+    _Atomic uint64_t head;
+
+    _Atomic uint64_t hits;
+    _Atomic uint64_t misses;
+    _Atomic uint64_t in_use;
+    _Atomic uint64_t peak;
+} ImHTTP_Buffer_Pool;
+
+typedef struct {
+    // * Borrows served from the slab
+    uint64_t hits;
+    // * Borrows that found the slab empty (the caller allocates then)
+    uint64_t misses;
+    // * Slab buffers lent out right now and at most at once
+    uint64_t in_use;
+    uint64_t peak;
+} ImHTTP_Buffer_Pool_Stats;
+
+bool imhttp_buffer_pool_init(ImHTTP_Buffer_Pool *pool, size_t buffer_size, uint32_t count);
+// * All the buffers must have been given back
+void imhttp_buffer_pool_free(ImHTTP_Buffer_Pool *pool);
+// * NULL if the slab is empty. Safe to call from any thread.
+char *imhttp_buffer_pool_borrow(ImHTTP_Buffer_Pool *pool);
+void imhttp_buffer_pool_give_back(ImHTTP_Buffer_Pool *pool, char *buffer);
+ImHTTP_Buffer_Pool_Stats imhttp_buffer_pool_stats(ImHTTP_Buffer_Pool *pool);
+
+// * Zero fields mean the defaults
+typedef struct {
+    // * Receive buffer to start with. IMHTTP_ROLLIN_BUFFER_CAPACITY by default.
+    size_t rollin_capacity;
+    // * The receive buffer doubles up to this when a line or an indexed
+    // * header block does not fit. IMHTTP_ROLLIN_BUFFER_MAX_CAPACITY by default.
+    size_t rollin_max_capacity;
+    // * Bodies that do not fit into the receive buffer are read with one of
+    // * this size (IMHTTP_BULK_READ_SIZE for instance). It goes back to
+    // * rollin_capacity at the next imhttp_res_begin(). Off by default.
+    size_t body_capacity;
+    // * Request staging buffer. IMHTTP_REQ_BUFFER_CAPACITY by default.
+    size_t req_capacity;
+    // * Optional. The receive buffer is borrowed from here (it has
+    // * pool->buffer_size bytes then, rollin_capacity is ignored) and only held
+    // * while there are unconsumed bytes: it is given back whenever the
+    // * parser runs out of bytes to wait on, and by imhttp_res_end(). A
+    // * buffer allocated because the pool was empty or too small is released
+    // * the same way. Indexed headers only last until imhttp_res_end() then.
+    ImHTTP_Buffer_Pool *rollin_pool;
+    // * libc by default
+    ImHTTP_Allocator allocator;
+} ImHTTP_Config;
 
+typedef enum {
+    IMHTTP_RES_STATUS,
+    IMHTTP_RES_HEADERS,
+    IMHTTP_RES_BODY,
+    IMHTTP_RES_TRAILERS,
+    IMHTTP_RES_DONE,
+    IMHTTP_RES_ERROR,
+} ImHTTP_Res_State;
+
+// * Where the chunked body decoder is within the current chunk
+typedef enum {
+    IMHTTP_CHUNK_SIZE,
+    IMHTTP_CHUNK_DATA,
+    IMHTTP_CHUNK_DATA_END,
+} ImHTTP_Chunk_State;
+
+typedef enum {
+    IMHTTP_OK,
+    // * Not enough bytes yet. Call again once the socket is readable
+    // * (or after imhttp_res_feed()), the parser resumes where it stopped.
+    IMHTTP_AGAIN,
+    // * Malformed response, read error or premature EOF. See res_error.
+    IMHTTP_ERROR,
+} ImHTTP_Result;
+
+typedef enum {
+    IMHTTP_EVENT_STATUS,
+    IMHTTP_EVENT_HEADER,
+    IMHTTP_EVENT_HEADERS_END,
+    IMHTTP_EVENT_BODY_CHUNK,
+    IMHTTP_EVENT_BODY_END,
+    IMHTTP_EVENT_TRAILER,
+    // * Returned again on every poll once the response is over
+    IMHTTP_EVENT_END,
+} ImHTTP_Event_Kind;
+
+// * Well-known header names as IMHTTP_HEADER(id, name, first, last), where
+// * `first` and `last` are the lowercased first and last characters of the
+// * name. They feed the perfect hash behind imhttp_header_lookup().
+#define IMHTTP_HEADERS(IMHTTP_HEADER) \
+    IMHTTP_HEADER(CONTENT_LENGTH,               "Content-Length",              'c', 'h') \
+    IMHTTP_HEADER(TRANSFER_ENCODING,            "Transfer-Encoding",           't', 'g') \
+    IMHTTP_HEADER(CONNECTION,                   "Connection",                  'c', 'n') \
+    IMHTTP_HEADER(CONTENT_ENCODING,             "Content-Encoding",            'c', 'g') \
+    IMHTTP_HEADER(CONTENT_TYPE,                 "Content-Type",                'c', 'e') \
+    IMHTTP_HEADER(ETAG,                         "ETag",                        'e', 'g') \
+    IMHTTP_HEADER(CACHE_CONTROL,                "Cache-Control",               'c', 'l') \
+    IMHTTP_HEADER(LOCATION,                     "Location",                    'l', 'n') \
+    IMHTTP_HEADER(DATE,                         "Date",                        'd', 'e') \
+    IMHTTP_HEADER(SERVER,                       "Server",                      's', 'r') \
+    IMHTTP_HEADER(LAST_MODIFIED,                "Last-Modified",               'l', 'd') \
+    IMHTTP_HEADER(EXPIRES,                      "Expires",                     'e', 's') \
+    IMHTTP_HEADER(SET_COOKIE,                   "Set-Cookie",                  's', 'e') \
+    IMHTTP_HEADER(KEEP_ALIVE,                   "Keep-Alive",                  'k', 'e') \
+    IMHTTP_HEADER(VARY,                         "Vary",                        'v', 'y') \
+    IMHTTP_HEADER(AGE,                          "Age",                         'a', 'e') \
+    IMHTTP_HEADER(ACCEPT_RANGES,                "Accept-Ranges",               'a', 's') \
+    IMHTTP_HEADER(CONTENT_RANGE,                "Content-Range",               'c', 'e') \
+    IMHTTP_HEADER(RETRY_AFTER,                  "Retry-After",                 'r', 'r') \
+    IMHTTP_HEADER(TRAILER,                      "Trailer",                     't', 'r') \
+    IMHTTP_HEADER(WWW_AUTHENTICATE,             "WWW-Authenticate",            'w', 'e') \
+    IMHTTP_HEADER(UPGRADE,                      "Upgrade",                     'u', 'e') \
+    IMHTTP_HEADER(CONTENT_DISPOSITION,          "Content-Disposition",         'c', 'n') \
+    IMHTTP_HEADER(CONTENT_LANGUAGE,             "Content-Language",            'c', 'e') \
+    IMHTTP_HEADER(CONTENT_LOCATION,             "Content-Location",            'c', 'n') \
+    IMHTTP_HEADER(ACCESS_CONTROL_ALLOW_ORIGIN,  "Access-Control-Allow-Origin", 'a', 'n') \
+    IMHTTP_HEADER(STRICT_TRANSPORT_SECURITY,    "Strict-Transport-Security",   's', 'y') \
+    IMHTTP_HEADER(VIA,                          "Via",                         'v', 'a') \
+    IMHTTP_HEADER(ALT_SVC,                      "Alt-Svc",                     'a', 'c') \
+    IMHTTP_HEADER(LINK,                         "Link",                        'l', 'k') \
+    IMHTTP_HEADER(PRAGMA,                       "Pragma",                      'p', 'a') \
+    IMHTTP_HEADER(X_CONTENT_TYPE_OPTIONS,       "X-Content-Type-Options",      'x', 's')
 
-static_assert(IMHTTP_USER_BUFFER_CAPACITY >= IMHTTP_ROLLIN_BUFFER_CAPACITY,
-"The user buffer should be at least as big as the rolling buffer"
-"because sometimes you may wanna put the whole rollin content into"
-"the user buffer.");
+typedef enum {
+    IMHTTP_HDR_UNKNOWN,
+#define IMHTTP_HEADER_ENUM(id, name, first, last) IMHTTP_HDR_##id,
+    IMHTTP_HEADERS(IMHTTP_HEADER_ENUM)
+#undef IMHTTP_HEADER_ENUM
+    IMHTTP_HDR_COUNT,
+} ImHTTP_Header;
+
+typedef struct {
+    ImHTTP_Event_Kind kind;
+    uint64_t status_code;        // * IMHTTP_EVENT_STATUS
+    String_View name, value;     // * IMHTTP_EVENT_HEADER, IMHTTP_EVENT_TRAILER
+    ImHTTP_Header header;        // * IMHTTP_EVENT_HEADER, IMHTTP_EVENT_TRAILER
+    String_View chunk;           // * IMHTTP_EVENT_BODY_CHUNK
+} ImHTTP_Event;
+
+// * Instrumentation, compiled in with -DIMHTTP_STATS (for every file that
+// * includes imhttp.h). Without it the recording macros expand to nothing
+// * and ImHTTP.stats is never looked at.
+
+typedef enum {
+    IMHTTP_PHASE_DNS_BEGIN,
+    IMHTTP_PHASE_DNS_END,
+    IMHTTP_PHASE_CONNECT_BEGIN,
+    IMHTTP_PHASE_CONNECT_END,
+    IMHTTP_PHASE_REQ_BEGIN,
+    IMHTTP_PHASE_REQ_END,
+    IMHTTP_PHASE_RES_BEGIN,
+    // * First response byte read (or already buffered at imhttp_res_begin())
+    IMHTTP_PHASE_FIRST_BYTE,
+    IMHTTP_PHASE_HEADERS_END,
+    IMHTTP_PHASE_BODY_END,
+    IMHTTP_PHASE_RES_END,
+    IMHTTP_PHASE_COUNT,
+} ImHTTP_Phase;
+
+typedef struct ImHTTP_Stats ImHTTP_Stats;
+
+// * Everything since the previous imhttp_res_end(). on_res_end() is called
+// * by imhttp_res_end() and the struct is cleared right after (except for
+// * the hook itself and user_data).
+struct ImHTTP_Stats {
+    // * CLOCK_MONOTONIC nanoseconds, 0 if the phase was not reached
+    uint64_t at[IMHTTP_PHASE_COUNT];
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    // * Response bytes moved inside rollin_buffer or copied in by imhttp_res_feed()
+    uint64_t bytes_copied;
+    // * Times rollin_buffer got new bytes
+    uint64_t refills;
+
+    void (*on_res_end)(const ImHTTP_Stats *stats, void *user_data);
+    void *user_data;
+};
+
+#define IMHTTP_HEADER_INDEX_CAPACITY 128
+
+// * Offsets are relative to ImHTTP_Header_Index.block
+typedef struct {
+    uint16_t header;             // * ImHTTP_Header
+    uint16_t name_length;
+    uint32_t name_offset;
+    uint32_t value_offset;
+    uint32_t value_length;
+} ImHTTP_Header_Entry;
+
+// * The whole header block of the current response parsed in one pass.
+// * See imhttp_res_index_headers().
+typedef struct {
+    const char *block;
+    size_t count;
+    // * Entry of the first occurrence of every known header, -1 if absent
+    int16_t first[IMHTTP_HDR_COUNT];
+    ImHTTP_Header_Entry entries[IMHTTP_HEADER_INDEX_CAPACITY];
+} ImHTTP_Header_Index;
+
+// * Content-Encoding of the current response. Stacked codings ("gzip, br")
+// * and the ones that can't be decoded are IMHTTP_ENCODING_OTHER.
+typedef enum {
+    IMHTTP_ENCODING_IDENTITY,
+    IMHTTP_ENCODING_GZIP,
+    IMHTTP_ENCODING_DEFLATE,
+    IMHTTP_ENCODING_OTHER,
+} ImHTTP_Encoding;
+
+// * Body decoding, compiled in with -DIMHTTP_ZLIB (for every file that
+// * includes imhttp.h) and linked with -lz. See imhttp_res_decode().
+typedef struct ImHTTP_Decoder ImHTTP_Decoder;
+
+#ifdef IMHTTP_ZLIB
+#define IMHTTP_DECODER_WINDOW_CAPACITY (32 * 1024)
+
+// * Zero it before the first use. The memory it takes does not depend on
+// * the body: the inflate state zlib allocates once and `window`.
+struct ImHTTP_Decoder {
+    z_stream stream;
+    bool initialized;
+    // * Deflate bodies are zlib streams, but some servers send them raw
+    bool sniff_raw_deflate;
+    // * Telling them apart takes two bytes, the first one may come alone
+    char sniff[2];
+    size_t sniff_count;
+    // * The end of the compressed stream was reached
+    bool finished;
+    // * The last inflate() filled `window` and may have more output buffered
+    bool window_full;
+    // * Decoded chunks point in here
+    char window[IMHTTP_DECODER_WINDOW_CAPACITY];
+};
+#endif
 
 typedef struct {
     ImHTTP_Socket socket;
     ImHTTP_Write write;
     ImHTTP_Read read;
+    ImHTTP_Writev writev;
+    ImHTTP_Sendfile sendfile;
+    ImHTTP_Splice splice;
+
+    // * See imhttp_init()
+    ImHTTP_Config config;
 
-    char rollin_buffer[IMHTTP_ROLLIN_BUFFER_CAPACITY];
+    // * Request line, headers and small body chunks are staged here and
+    // * flushed in one go by imhttp_req_end() or when the buffer fills up
+    char *req_buffer;
+    size_t req_buffer_capacity;
+    size_t req_buffer_size;
+
+    // * Between imhttp_pipeline_begin() and imhttp_pipeline_end()
+    // * imhttp_req_end() does not flush, so all the requests leave together
+    bool pipelining;
+    // * Requests sent whose responses were not fully consumed yet
+    size_t requests_in_flight;
+    // * Why request bytes could not be written (errno tells more), NULL
+    // * while the connection is usable. Once set nothing is written anymore
+    // * and the imhttp_req_* functions return false. Cleared by imhttp_init().
+    const char *req_error;
+
+    // * Everything handed out by the imhttp_res_* functions points straight
+    // * into rollin_buffer and stays valid until the next imhttp_res_* call.
+    // *
+    // * rollin_buffer is a ring: the unconsumed bytes live at
+    // * [rollin_buffer_head, rollin_buffer_head + rollin_buffer_size).
+    // * If the ring is mirrored (the same pages mapped twice back to back,
+    // * see ring.h) that range is always contiguous, even when it wraps.
+    // * Otherwise reads never wrap and the unconsumed tail (at most one
+    // * incomplete line) is moved to the front once the end is reached.
+    // *
+    // * rollin_buffer is allocated on first use unless
+    // * imhttp_set_rollin_buffer() was called. Only the allocated one grows
+    // * (see ImHTTP_Config), which moves it, so nothing handed out survives
+    // * past the next imhttp_res_* call then.
+    char *rollin_buffer;
+    size_t rollin_buffer_capacity;
+    bool rollin_buffer_mirrored;
+    bool rollin_buffer_owned;
+    // * Borrowed from config.rollin_pool
+    bool rollin_buffer_pooled;
+    // * Lets a plain buffer given to imhttp_set_rollin_buffer() be left for
+    // * an allocated one once a line does not fit into it. The owner can
+    // * tell by rollin_buffer_owned turning true.
+    bool rollin_buffer_spill;
+    size_t rollin_buffer_head;
     size_t rollin_buffer_size;
+    // * Set by imhttp_res_feed_eof() in push mode
+    bool rollin_eof;
+    // * Set by push-mode transports while a receive into the space handed
+    // * out by imhttp_res_feed_reserve() is in flight (io_uring). The buffer
+    // * is neither given back to the pool nor shrunk meanwhile.
+    bool rollin_receiving;
+    // * The first rollin_pinned bytes hold the indexed header block and are
+    // * not reused until the next imhttp_res_begin(). Past them the ring
+    // * works like a non-mirrored one.
+    size_t rollin_pinned;
+
+    // * Optional, only used with IMHTTP_STATS
+    ImHTTP_Stats *stats;
+
+    // * Optional, see imhttp_res_decode()
+    ImHTTP_Decoder *decoder;
 
-    char user_buffer[IMHTTP_USER_BUFFER_CAPACITY];
-    size_t user_buffer_size;
-    
-    int content_length;
+    // * Optional, see imhttp_res_index_headers()
+    ImHTTP_Header_Index *header_index;
+    // * Next index entry to hand out as IMHTTP_EVENT_HEADER
+    size_t header_cursor;
+
+    // * Per-response state, reset by imhttp_res_begin()
+    ImHTTP_Res_State res_state;
+    const char *res_error;
+    // * How much of the unconsumed bytes is known not to contain \r\n
+    size_t line_scanned;
+    uint64_t status_code;
+    // * What is left of the body, -1 if there is no Content-Length
+    int64_t content_length;
     bool chunked;
+    ImHTTP_Chunk_State chunk_state;
+    uint64_t chunk_remaining;
+    ImHTTP_Encoding content_encoding;
+    // * The body chunks handed out go through `decoder`
+    bool decoding;
+    // * Whether the connection can carry another request once this
+    // * response is fully consumed. Decided by the HTTP version of the
+    // * status line, the Connection header and the body framing.
+    bool keep_alive;
 } ImHTTP;
 
-void imhttp_req_begin(ImHTTP *imhttp, ImHTTP_Method method, const char *resource);
-void imhttp_req_header(ImHTTP *imhttp, const char *header_name, const char *header_value);
-void imhttp_req_headers_end(ImHTTP *imhttp);
-void imhttp_req_body_chunk(ImHTTP *imhttp, const char *chunk_cstr);
-void imhttp_req_body_chunk_sized(ImHTTP *imhttp, const char *chunk, size_t chunk_size);
-void imhttp_req_end(ImHTTP *imhttp);
+// * Optional. A zeroed ImHTTP works with the default ImHTTP_Config.
+// * Resets `imhttp`, the buffers are allocated on first use.
+void imhttp_init(ImHTTP *imhttp, const ImHTTP_Config *config);
+// * Releases the buffers ImHTTP allocated. The socket is left alone.
+void imhttp_free(ImHTTP *imhttp);
+
+// * The imhttp_req_* functions return false once imhttp->req_error is set.
+// * Bytes may be staged and only written by a later call, so checking the
+// * result of imhttp_req_end() (or imhttp_pipeline_end()) is enough.
+bool imhttp_req_begin(ImHTTP *imhttp, ImHTTP_Method method, const char *resource);
+bool imhttp_req_header(ImHTTP *imhttp, const char *header_name, const char *header_value);
+bool imhttp_req_headers_end(ImHTTP *imhttp);
+bool imhttp_req_body_chunk(ImHTTP *imhttp, const char *chunk_cstr);
+bool imhttp_req_body_chunk_sized(ImHTTP *imhttp, const char *chunk, size_t chunk_size);
+// * Takes the place of imhttp_req_headers_end(): writes Content-Length and
+// * the end of the headers, then `length` bytes of the file `fd` starting at
+// * `offset` as the body. Goes through imhttp->sendfile when there is one.
+// * Otherwise the file is read in chunks into a buffer borrowed from
+// * config.rollin_pool (or the request staging buffer), which moves the file
+// * offset of `fd` and also works for pipes with `offset` 0. Returns false if the file could not be read up to
+// * `length` or the body could not be sent. The connection is unusable
+// * then (req_error is set), the server is still waiting for the rest of the body.
+bool imhttp_req_body_file(ImHTTP *imhttp, int fd, uint64_t offset, uint64_t length);
+bool imhttp_req_end(ImHTTP *imhttp);
+
+// * Pipelining
+// *
+// * imhttp_pipeline_begin();
+// * N x (imhttp_req_begin() ... imhttp_req_end());
+// * imhttp_pipeline_end();
+// * N x (imhttp_res_begin() ... imhttp_res_end());
+// *
+// * The responses come back in the order the requests were made. Keep the
+// * total size of the requests reasonable: nothing is read while they are
+// * being written, so a server that stops reading until its responses are
+// * consumed would block both sides.
+void imhttp_pipeline_begin(ImHTTP *imhttp);
+bool imhttp_pipeline_end(ImHTTP *imhttp);
+
+// * Request templates
+// *
+// * For requests that only differ in a few values. The fixed part is
+// * serialized once, with slots left for the values, and every request then
+// * goes out as a single writev() of the template and the values as they
+// * are: nothing is formatted or copied per request. When pipelining, or
+// * without a `writev` callback, the pieces are staged in req_buffer instead.
+// *
+// * ImHTTP_Template items = {0};
+// * imhttp_template_begin(&items, IMHTTP_GET, "/items/");
+// * imhttp_template_path_slot(&items);                   // * value 0
+// * imhttp_template_header(&items, "Host", "example.com");
+// * imhttp_template_header_slot(&items, "Authorization"); // * value 1
+// * imhttp_template_end(&items);
+// *
+// * String_View values[] = { id, token };
+// * imhttp_req_template(imhttp, &items, values, NULL, 0);
+// * imhttp_res_begin(imhttp); ...
+
+#define IMHTTP_TEMPLATE_SLOTS_CAPACITY 8
+
+typedef enum {
+    // * Filled with the value passed for it
+    IMHTTP_SLOT_VALUE,
+    // * Filled with the size of the body
+    IMHTTP_SLOT_CONTENT_LENGTH,
+} ImHTTP_Slot_Kind;
+
+typedef struct {
+    // * Where it goes in between the fixed bytes
+    size_t offset;
+    ImHTTP_Slot_Kind kind;
+} ImHTTP_Template_Slot;
+
+typedef struct {
+    // * The fixed bytes of the request, the slots cut out
+    char *data;
+    size_t size;
+    size_t capacity;
+    ImHTTP_Template_Slot slots[IMHTTP_TEMPLATE_SLOTS_CAPACITY];
+    size_t slots_count;
+    size_t values_count;
+    bool request_line_done;
+    bool has_body;
+    bool ended;
+    // * An allocation failed, the template can't be used
+    bool out_of_memory;
+    // * Optional, libc by default. Set it before imhttp_template_begin(),
+    // * to imhttp->config.allocator for instance.
+    ImHTTP_Allocator allocator;
+} ImHTTP_Template;
+
+// * `path` is the whole path, or the fixed prefix of it with a path slot
+void imhttp_template_begin(ImHTTP_Template *template, ImHTTP_Method method, const char *path);
+// * Only right after imhttp_template_begin(). The slot functions return the
+// * index of their value.
+size_t imhttp_template_path_slot(ImHTTP_Template *template);
+void imhttp_template_header(ImHTTP_Template *template, const char *header_name, const char *header_value);
+size_t imhttp_template_header_slot(ImHTTP_Template *template, const char *header_name);
+// * The requests carry a body, its size is filled in. Takes no value.
+void imhttp_template_content_length(ImHTTP_Template *template);
+// * Returns false if the template ran out of memory while being built
+bool imhttp_template_end(ImHTTP_Template *template);
+void imhttp_template_free(ImHTTP_Template *template);
+// * A whole request, imhttp_req_begin() to imhttp_req_end(). `values` has
+// * one entry per value slot, in the order the slots were added. A `body`
+// * needs a Content-Length slot and is sent as it is, like big
+// * imhttp_req_body_chunk_sized() ones. A template that ran out of memory
+// * sends nothing and returns false, the connection stays usable.
+bool imhttp_req_template(ImHTTP *imhttp, const ImHTTP_Template *template,
+			 const String_View *values, const char *body, size_t body_size);
 
 // Response handlers
+// *
+// * The parser is a state machine driven by imhttp_res_poll(). It pulls
+// * bytes with the `read` callback. If `read` fails with EAGAIN it returns
+// * IMHTTP_AGAIN and picks up exactly where it stopped on the next call.
+// * With `read` set to NULL the bytes are pushed with imhttp_res_feed()
+// * instead. The imhttp_res_next_* functions below are the blocking
+// * interface built on top of it.
+// * Replaces the receive ring. `mirrored` rings must have the `capacity`
+// * bytes after `buffer` mapped onto `buffer` itself (see ring_mirror_alloc()).
+// * Must be called while the ring holds no unconsumed bytes. The buffer is
+// * never resized (see rollin_buffer_spill), and the allocated one it
+// * replaces is released.
+void imhttp_set_rollin_buffer(ImHTTP *imhttp, char *buffer, size_t capacity, bool mirrored);
+
+// * Case-insensitive and O(1). IMHTTP_HDR_UNKNOWN for anything not in IMHTTP_HEADERS.
+ImHTTP_Header imhttp_header_lookup(String_View name);
+// * Canonical spelling, NULL for IMHTTP_HDR_UNKNOWN
+const char *imhttp_header_name(ImHTTP_Header header);
+
 void imhttp_res_begin(ImHTTP *imhttp);
+// * Optional. From the next imhttp_res_begin() on, the whole header block is
+// * waited for and parsed in one pass into `index` (NULL turns it off). The
+// * block stays pinned in rollin_buffer so the headers (the ones handed out
+// * as events too) stay valid until the next imhttp_res_begin(), or until
+// * the next imhttp_res_* call if the buffer can grow (imhttp_res_header_get()
+// * is always safe). The block must fit into rollin_buffer and have at most
+// * IMHTTP_HEADER_INDEX_CAPACITY fields. Trailers are not indexed.
+void imhttp_res_index_headers(ImHTTP *imhttp, ImHTTP_Header_Index *index);
+// * O(1) lookup of the first field named `header`. Returns a view with
+// * data == NULL if there is none or the headers are not indexed (yet).
+String_View imhttp_res_header_get(ImHTTP *imhttp, ImHTTP_Header header);
+// * All the indexed fields in the order they came, unknown ones included
+size_t imhttp_res_header_count(ImHTTP *imhttp);
+void imhttp_res_header_at(ImHTTP *imhttp, size_t i, String_View *name, String_View *value);
 uint64_t imhttp_res_status_code(ImHTTP *imhttp);
 bool imhttp_res_next_header(ImHTTP *imhttp, String_View *name, String_View *value);
+// * Chunked bodies are decoded transparently, the chunks handed out are the
+// * payloads without the framing
 bool imhttp_res_next_body_chunk(ImHTTP *imhttp, String_View *chunk);
+// * Writes the rest of the body into `out_fd` and returns how many bytes that
+// * was, -1 if the response failed (see res_error). The bytes already
+// * buffered go first. The rest of a Content-Length body is then moved by
+// * imhttp->splice if the transport has one, other bodies are written chunk
+// * by chunk. Blocking API.
+int64_t imhttp_res_body_to_fd(ImHTTP *imhttp, int out_fd);
+// * Trailer fields sent after the last chunk of a chunked body.
+// * Skips the rest of the body if it was not read yet.
+bool imhttp_res_next_trailer(ImHTTP *imhttp, String_View *name, String_View *value);
+// * Consumes whatever is left of the response so the connection can be reused
 void imhttp_res_end(ImHTTP *imhttp);
 
+#ifdef IMHTTP_ZLIB
+// * Optional. From the next imhttp_res_begin() on, bodies with a gzip, x-gzip
+// * or deflate Content-Encoding are inflated on the fly: the body chunks
+// * (from imhttp_res_next_body_chunk(), imhttp_res_poll() and
+// * imhttp_res_body_to_fd()) are the decoded bytes, at most
+// * IMHTTP_DECODER_WINDOW_CAPACITY at a time, pointing into `decoder`.
+// * The framing (chunked or Content-Length) is undone first. The headers are
+// * reported as received. One decoder serves one ImHTTP, NULL turns it off.
+void imhttp_res_decode(ImHTTP *imhttp, ImHTTP_Decoder *decoder);
+// * Releases what zlib allocated
+void imhttp_decoder_free(ImHTTP_Decoder *decoder);
+#endif
+
+// * Non-blocking interface. Call imhttp_res_begin() first, then poll until
+// * IMHTTP_EVENT_END. The views in `event` stay valid until the next call.
+ImHTTP_Result imhttp_res_poll(ImHTTP *imhttp, ImHTTP_Event *event);
+
+// * Push mode. imhttp_res_feed() copies as many bytes as fit into the ring
+// * and returns how many were taken. imhttp_res_feed_reserve() and
+// * imhttp_res_feed_commit() let the caller receive straight into it.
+size_t imhttp_res_feed(ImHTTP *imhttp, const void *data, size_t size);
+size_t imhttp_res_feed_reserve(ImHTTP *imhttp, char **dst);
+void imhttp_res_feed_commit(ImHTTP *imhttp, size_t size);
+// * The other side closed the connection
+void imhttp_res_feed_eof(ImHTTP *imhttp);
+
+#ifdef IMHTTP_STATS
+void imhttp_stats_mark(ImHTTP *imhttp, ImHTTP_Phase phase);
+void imhttp_stats_res_end(ImHTTP *imhttp);
+#define IMHTTP_STATS_MARK(imhttp, phase) imhttp_stats_mark((imhttp), (phase))
+#define IMHTTP_STATS_ADD(imhttp, counter, n) \
+    do { if((imhttp)->stats != NULL) (imhttp)->stats->counter += (n); } while(0)
+#else
+#define IMHTTP_STATS_MARK(imhttp, phase) ((void) (imhttp))
+#define IMHTTP_STATS_ADD(imhttp, counter, n) ((void) (imhttp))
+#endif // IMHTTP_STATS
+
 #endif // IMHTTP_H_
 
 
 #ifdef IMHTTP_IMPLEMENTATION
 
+#include<stdlib.h>
+#include<unistd.h>
+
+// * Called with the number of response bytes the library copies around by
+// * itself (ring relocations, imhttp_res_feed()). Define it before including
+// * the implementation to account for them, the default costs nothing.
+#ifndef IMHTTP_COUNT_COPY
+#define IMHTTP_COUNT_COPY(imhttp, n) IMHTTP_STATS_ADD(imhttp, bytes_copied, n)
+#endif
+
+#ifdef IMHTTP_STATS
+#include<time.h>
+
+void imhttp_stats_mark(ImHTTP *imhttp, ImHTTP_Phase phase) {
+    if(imhttp == NULL || imhttp->stats == NULL) return;
+    // * Only the first byte of the response counts
+    if(phase == IMHTTP_PHASE_FIRST_BYTE && imhttp->stats->at[phase] != 0) return;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    imhttp->stats->at[phase] = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void imhttp_stats_res_end(ImHTTP *imhttp) {
+    ImHTTP_Stats *stats = imhttp->stats;
+    if(stats == NULL) return;
+
+    imhttp_stats_mark(imhttp, IMHTTP_PHASE_RES_END);
+    if(stats->on_res_end != NULL) {
+	stats->on_res_end(stats, stats->user_data);
+    }
+    *stats = (ImHTTP_Stats) {
+	.on_res_end = stats->on_res_end,
+	.user_data = stats->user_data,
+    };
+}
+#endif // IMHTTP_STATS
 
 static const char* imhttp_method_as_cstr(ImHTTP_Method method) {
     switch(method) {
@@ -74,194 +656,1679 @@ default:
 // For req & res format
 // https://developer.mozilla.org/en-US/docs/Web/HTTP/Messages
 
-static void imhttp_write_cstr(ImHTTP *imhttp, const char* cstr) {
-    size_t cstr_size = strlen(cstr);
-    imhttp->write(imhttp->socket, cstr, cstr_size);
+static bool imhttp_write_all(ImHTTP *imhttp, const char *buf, size_t count) {
+    if(imhttp->req_error != NULL) return false;
+    while(count > 0) {
+	ssize_t n = imhttp->write(imhttp->socket, buf, count);
+	if(n < 0 && errno == EINTR) continue;
+	if(n <= 0) {
+	    imhttp->req_error = "Could not send the request";
+	    return false;
+	}
+	IMHTTP_STATS_ADD(imhttp, writes, 1);
+	IMHTTP_STATS_ADD(imhttp, bytes_written, n);
+	buf += n;
+	count -= n;
+    }
+    return true;
+}
+
+static bool imhttp_writev_all(ImHTTP *imhttp, ImHTTP_Iovec *iov, int iovcnt) {
+    if(imhttp->req_error != NULL) return false;
+    while(iovcnt > 0) {
+	ssize_t n = imhttp->writev(imhttp->socket, iov, iovcnt);
+	if(n < 0 && errno == EINTR) continue;
+	if(n <= 0) {
+	    imhttp->req_error = "Could not send the request";
+	    return false;
+	}
+	IMHTTP_STATS_ADD(imhttp, writes, 1);
+	IMHTTP_STATS_ADD(imhttp, bytes_written, n);
+
+	// * Skip whatever was fully written and resume from the partial iovec
+	while(iovcnt > 0 && (size_t) n >= iov->len) {
+	    n -= iov->len;
+	    iov++;
+	    iovcnt--;
+	}
+	if(iovcnt > 0) {
+	    iov->base = (const char*) iov->base + n;
+	    iov->len -= n;
+	}
+    }
+    return true;
+}
+
+#define IMHTTP_BUFFER_POOL_NIL UINT32_MAX
+
+bool imhttp_buffer_pool_init(ImHTTP_Buffer_Pool *pool, size_t buffer_size, uint32_t count) {
+    assert(buffer_size > 0 && count < IMHTTP_BUFFER_POOL_NIL);
+    pool->slab = malloc(buffer_size * count);
+    pool->next = malloc(count * sizeof(*pool->next));
+    if(pool->slab == NULL || pool->next == NULL) {
+	free(pool->slab);
+	free((void *) pool->next);
+	return false;
+    }
+    pool->buffer_size = buffer_size;
+    pool->count = count;
+
+    for(uint32_t i = 0; i < count; ++i) {
+	atomic_init(&pool->next[i], i + 1 < count ? i + 1 : IMHTTP_BUFFER_POOL_NIL);
+    }
+    atomic_init(&pool->head, count > 0 ? 0 : IMHTTP_BUFFER_POOL_NIL);
+    atomic_init(&pool->hits, 0);
+    atomic_init(&pool->misses, 0);
+    atomic_init(&pool->in_use, 0);
+    atomic_init(&pool->peak, 0);
+    return true;
+}
+
+void imhttp_buffer_pool_free(ImHTTP_Buffer_Pool *pool) {
+    assert(atomic_load(&pool->in_use) == 0 && "imhttp_buffer_pool_free: buffers are still lent out");
+    free(pool->slab);
+    free((void *) pool->next);
+    pool->slab = NULL;
+    pool->next = NULL;
+}
+
+char *imhttp_buffer_pool_borrow(ImHTTP_Buffer_Pool *pool) {
+    uint64_t head = atomic_load_explicit(&pool->head, memory_order_acquire);
+    uint32_t index;
+    for(;;) {
+	index = (uint32_t) head;
+	if(index == IMHTTP_BUFFER_POOL_NIL) {
+	    atomic_fetch_add_explicit(&pool->misses, 1, memory_order_relaxed);
+	    return NULL;
+	}
+	// * Stale if `index` got taken meanwhile, but then the tag changed too
+	uint32_t next = atomic_load_explicit(&pool->next[index], memory_order_relaxed);
+	uint64_t new_head = (((head >> 32) + 1) << 32) | next;
+	if(atomic_compare_exchange_weak_explicit(&pool->head, &head, new_head,
+						 memory_order_acquire, memory_order_acquire)) {
+	    break;
+	}
+    }
+
+    atomic_fetch_add_explicit(&pool->hits, 1, memory_order_relaxed);
+    uint64_t in_use = atomic_fetch_add_explicit(&pool->in_use, 1, memory_order_relaxed) + 1;
+    uint64_t peak = atomic_load_explicit(&pool->peak, memory_order_relaxed);
+    while(in_use > peak
+	  && !atomic_compare_exchange_weak_explicit(&pool->peak, &peak, in_use,
+						    memory_order_relaxed, memory_order_relaxed)) {}
+
+    return pool->slab + (size_t) index * pool->buffer_size;
+}
+
+void imhttp_buffer_pool_give_back(ImHTTP_Buffer_Pool *pool, char *buffer) {
+    assert(buffer >= pool->slab && buffer < pool->slab + (size_t) pool->count * pool->buffer_size);
+    uint32_t index = (buffer - pool->slab) / pool->buffer_size;
+    // * Before the push, so the buffer is never counted twice
+    atomic_fetch_sub_explicit(&pool->in_use, 1, memory_order_relaxed);
+
+    uint64_t head = atomic_load_explicit(&pool->head, memory_order_relaxed);
+    uint64_t new_head;
+    do {
+	atomic_store_explicit(&pool->next[index], (uint32_t) head, memory_order_relaxed);
+	new_head = (((head >> 32) + 1) << 32) | index;
+    } while(!atomic_compare_exchange_weak_explicit(&pool->head, &head, new_head,
+						   memory_order_release, memory_order_relaxed));
+}
+
+ImHTTP_Buffer_Pool_Stats imhttp_buffer_pool_stats(ImHTTP_Buffer_Pool *pool) {
+    return (ImHTTP_Buffer_Pool_Stats) {
+	.hits = atomic_load_explicit(&pool->hits, memory_order_relaxed),
+	.misses = atomic_load_explicit(&pool->misses, memory_order_relaxed),
+	.in_use = atomic_load_explicit(&pool->in_use, memory_order_relaxed),
+	.peak = atomic_load_explicit(&pool->peak, memory_order_relaxed),
+    };
+}
+
+static void *imhttp_allocator_resize(const ImHTTP_Allocator *allocator, void *ptr, size_t old_size, size_t new_size) {
+    if(allocator->resize != NULL) {
+	return allocator->resize(allocator->user_data, ptr, old_size, new_size);
+    }
+    if(new_size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    return realloc(ptr, new_size);
+}
+
+static void *imhttp_resize(ImHTTP *imhttp, void *ptr, size_t old_size, size_t new_size) {
+    return imhttp_allocator_resize(&imhttp->config.allocator, ptr, old_size, new_size);
+}
+
+static void imhttp_config_defaults(ImHTTP_Config *config) {
+    if(config->rollin_capacity == 0) config->rollin_capacity = IMHTTP_ROLLIN_BUFFER_CAPACITY;
+    if(config->rollin_max_capacity == 0) config->rollin_max_capacity = IMHTTP_ROLLIN_BUFFER_MAX_CAPACITY;
+    if(config->rollin_max_capacity < config->rollin_capacity) {
+	config->rollin_max_capacity = config->rollin_capacity;
+    }
+    if(config->req_capacity == 0) config->req_capacity = IMHTTP_REQ_BUFFER_CAPACITY;
+}
+
+void imhttp_init(ImHTTP *imhttp, const ImHTTP_Config *config) {
+    *imhttp = (ImHTTP) {0};
+    if(config != NULL) imhttp->config = *config;
+    imhttp_config_defaults(&imhttp->config);
+}
+
+// * Drops the buffer that came from the pool or the allocator
+static void imhttp_rollin_buffer_drop(ImHTTP *imhttp) {
+    if(imhttp->rollin_buffer_pooled) {
+	imhttp_buffer_pool_give_back(imhttp->config.rollin_pool, imhttp->rollin_buffer);
+    } else if(imhttp->rollin_buffer_owned) {
+	imhttp_resize(imhttp, imhttp->rollin_buffer, imhttp->rollin_buffer_capacity, 0);
+    }
+    imhttp->rollin_buffer_pooled = false;
+    imhttp->rollin_buffer_owned = false;
+}
+
+void imhttp_free(ImHTTP *imhttp) {
+    if(imhttp->rollin_buffer_owned || imhttp->rollin_buffer_pooled) {
+	imhttp_rollin_buffer_drop(imhttp);
+	imhttp->rollin_buffer = NULL;
+	imhttp->rollin_buffer_capacity = 0;
+    }
+    imhttp->rollin_buffer_head = 0;
+    imhttp->rollin_buffer_size = 0;
+    imhttp->rollin_pinned = 0;
+
+    imhttp_resize(imhttp, imhttp->req_buffer, imhttp->req_buffer_capacity, 0);
+    imhttp->req_buffer = NULL;
+    imhttp->req_buffer_capacity = 0;
+    imhttp->req_buffer_size = 0;
+}
+
+// * Whatever happens the staged bytes are gone, a connection that failed
+// * to write them is not usable anymore
+static bool imhttp_req_flush(ImHTTP *imhttp) {
+    bool ok = imhttp_write_all(imhttp, imhttp->req_buffer, imhttp->req_buffer_size);
+    imhttp->req_buffer_size = 0;
+    return ok;
+}
+
+static bool imhttp_req_write(ImHTTP *imhttp, const char *data, size_t size) {
+    if(imhttp->req_error != NULL) return false;
+    if(imhttp->req_buffer == NULL) {
+	imhttp_config_defaults(&imhttp->config);
+	imhttp->req_buffer = imhttp_resize(imhttp, NULL, 0, imhttp->config.req_capacity);
+	if(imhttp->req_buffer == NULL) {
+	    imhttp->req_error = "Out of memory";
+	    return false;
+	}
+	imhttp->req_buffer_capacity = imhttp->config.req_capacity;
+    }
+    const size_t capacity = imhttp->req_buffer_capacity;
+
+    // * Fits into what is left of the staging buffer
+    if(size <= capacity - imhttp->req_buffer_size) {
+	memcpy(imhttp->req_buffer + imhttp->req_buffer_size, data, size);
+	imhttp->req_buffer_size += size;
+	return true;
+    }
+
+    // * Small enough to be staged after flushing the current content
+    if(size < capacity) {
+	if(!imhttp_req_flush(imhttp)) return false;
+	memcpy(imhttp->req_buffer, data, size);
+	imhttp->req_buffer_size = size;
+	return true;
+    }
+
+    // * Big payloads are never copied
+    if(imhttp->writev) {
+	ImHTTP_Iovec iov[2] = {
+	    { .base = imhttp->req_buffer, .len = imhttp->req_buffer_size },
+	    { .base = data,               .len = size },
+	};
+	imhttp->req_buffer_size = 0;
+	return imhttp_writev_all(imhttp, iov, 2);
+    }
+    return imhttp_req_flush(imhttp) && imhttp_write_all(imhttp, data, size);
+}
+
+static bool imhttp_write_cstr(ImHTTP *imhttp, const char* cstr) {
+    return imhttp_req_write(imhttp, cstr, strlen(cstr));
 }
 
 // This function will write following line to socket
 // * GET / HTTP/1.1\r\n
-void imhttp_req_begin(ImHTTP *imhttp, ImHTTP_Method method, const char *resource) {
-    imhttp_write_cstr(imhttp, imhttp_method_as_cstr(method));
-    imhttp_write_cstr(imhttp, " ");
-    imhttp_write_cstr(imhttp, resource);
-    imhttp_write_cstr(imhttp, " HTTP/1.0\r\n");
+// * HTTP/1.1 keeps the connection alive by default, so don't forget the Host header
+bool imhttp_req_begin(ImHTTP *imhttp, ImHTTP_Method method, const char *resource) {
+    IMHTTP_STATS_MARK(imhttp, IMHTTP_PHASE_REQ_BEGIN);
+    return imhttp_write_cstr(imhttp, imhttp_method_as_cstr(method))
+	&& imhttp_write_cstr(imhttp, " ")
+	&& imhttp_write_cstr(imhttp, resource)
+	&& imhttp_write_cstr(imhttp, " HTTP/1.1\r\n");
 }
 
 // * This function will write some headers to socket in following format
 // * Host: google.com
-void imhttp_req_header(ImHTTP *imhttp, const char *header_name, const char *header_value) {
-    imhttp_write_cstr(imhttp, header_name);
-    imhttp_write_cstr(imhttp, ": ");
-    imhttp_write_cstr(imhttp, header_value);
-    imhttp_write_cstr(imhttp, "\r\n");
+bool imhttp_req_header(ImHTTP *imhttp, const char *header_name, const char *header_value) {
+    return imhttp_write_cstr(imhttp, header_name)
+	&& imhttp_write_cstr(imhttp, ": ")
+	&& imhttp_write_cstr(imhttp, header_value)
+	&& imhttp_write_cstr(imhttp, "\r\n");
 }
 
 // * Finish the request format with \r\n
-void imhttp_req_headers_end(ImHTTP *imhttp) {
-    imhttp_write_cstr(imhttp, "\r\n");
+// * Nothing is flushed yet so small bodies still go out with the headers
+bool imhttp_req_headers_end(ImHTTP *imhttp) {
+    return imhttp_write_cstr(imhttp, "\r\n");
+}
+
+bool imhttp_req_body_chunk(ImHTTP *imhttp, const char *chunk_cstr) {
+    return imhttp_write_cstr(imhttp, chunk_cstr);
+}
+
+bool imhttp_req_body_chunk_sized(ImHTTP *imhttp, const char *chunk, size_t chunk_size) {
+    return imhttp_req_write(imhttp, chunk, chunk_size);
+}
+
+// * Writes `value` in decimal into `buffer` (at least 21 bytes) and returns its length
+static size_t imhttp_u64_to_cstr(uint64_t value, char *buffer) {
+    char digits[20];
+    size_t count = 0;
+    do {
+	digits[count++] = '0' + value % 10;
+	value /= 10;
+    } while(value > 0);
+    for(size_t i = 0; i < count; ++i) buffer[i] = digits[count - 1 - i];
+    buffer[count] = '\0';
+    return count;
+}
+
+// * Read and write fallback of imhttp_req_body_file()
+static bool imhttp_req_copy_file(ImHTTP *imhttp, int fd, uint64_t offset, uint64_t length) {
+    // * Pipes can't seek, they are fine as long as nothing has to be skipped
+    if(lseek(fd, (off_t) offset, SEEK_SET) == (off_t) -1 && !(errno == ESPIPE && offset == 0)) {
+	imhttp->req_error = "Could not read the request body file";
+	return false;
+    }
+
+    char *buffer = imhttp->req_buffer;
+    size_t capacity = imhttp->req_buffer_capacity;
+    char *borrowed = imhttp->config.rollin_pool != NULL ? imhttp_buffer_pool_borrow(imhttp->config.rollin_pool) : NULL;
+    if(borrowed != NULL && imhttp->config.rollin_pool->buffer_size > capacity) {
+	buffer = borrowed;
+	capacity = imhttp->config.rollin_pool->buffer_size;
+    }
+
+    bool ok = true;
+    while(length > 0) {
+	size_t count = length < capacity ? (size_t) length : capacity;
+	ssize_t n = read(fd, buffer, count);
+	if(n < 0 && errno == EINTR) continue;
+	if(n <= 0) {
+	    imhttp->req_error = "Could not read the request body file";
+	    ok = false;
+	    break;
+	}
+	if(!imhttp_write_all(imhttp, buffer, n)) {
+	    ok = false;
+	    break;
+	}
+	length -= n;
+    }
+
+    if(borrowed != NULL) imhttp_buffer_pool_give_back(imhttp->config.rollin_pool, borrowed);
+    return ok;
+}
+
+bool imhttp_req_body_file(ImHTTP *imhttp, int fd, uint64_t offset, uint64_t length) {
+    char content_length[21];
+    imhttp_u64_to_cstr(length, content_length);
+    // * The body does not go through req_buffer
+    if(!imhttp_req_header(imhttp, "Content-Length", content_length)
+       || !imhttp_req_headers_end(imhttp)
+       || !imhttp_req_flush(imhttp)) {
+	return false;
+    }
+
+    int64_t position = (int64_t) offset;
+    uint64_t left = length;
+    while(imhttp->sendfile != NULL && left > 0) {
+	ssize_t n = imhttp->sendfile(imhttp->socket, fd, &position, left);
+	if(n < 0 && errno == EINTR) continue;
+	if(n < 0 && left == length && (errno == EINVAL || errno == ESPIPE || errno == ENOSYS)) break;
+	// * 0 means the file is shorter than promised
+	if(n <= 0) {
+	    imhttp->req_error = n == 0 ? "Could not read the request body file" : "Could not send the request";
+	    return false;
+	}
+	IMHTTP_STATS_ADD(imhttp, writes, 1);
+	IMHTTP_STATS_ADD(imhttp, bytes_written, n);
+	left -= n;
+    }
+    if(left == 0) return true;
+
+    return imhttp_req_copy_file(imhttp, fd, offset + (length - left), left);
+}
+
+// * Sends everything that is still staged in req_buffer
+bool imhttp_req_end(ImHTTP *imhttp) {
+    imhttp->requests_in_flight += 1;
+    bool ok = imhttp->pipelining ? imhttp->req_error == NULL : imhttp_req_flush(imhttp);
+    IMHTTP_STATS_MARK(imhttp, IMHTTP_PHASE_REQ_END);
+    return ok;
+}
+
+void imhttp_pipeline_begin(ImHTTP *imhttp) {
+    imhttp->pipelining = true;
+}
+
+bool imhttp_pipeline_end(ImHTTP *imhttp) {
+    imhttp->pipelining = false;
+    return imhttp_req_flush(imhttp);
+}
+
+static void imhttp_template_write(ImHTTP_Template *template, const char *data, size_t size) {
+    assert(!template->ended && "imhttp_template: the template is already ended");
+    if(template->out_of_memory) return;
+    if(template->size + size > template->capacity) {
+	size_t capacity = template->capacity > 0 ? template->capacity : 256;
+	while(capacity < template->size + size) capacity *= 2;
+	char *new_data = imhttp_allocator_resize(&template->allocator, template->data, template->capacity, capacity);
+	if(new_data == NULL) {
+	    template->out_of_memory = true;
+	    return;
+	}
+	template->data = new_data;
+	template->capacity = capacity;
+    }
+    memcpy(template->data + template->size, data, size);
+    template->size += size;
+}
+
+static void imhttp_template_write_cstr(ImHTTP_Template *template, const char *cstr) {
+    imhttp_template_write(template, cstr, strlen(cstr));
+}
+
+static void imhttp_template_slot(ImHTTP_Template *template, ImHTTP_Slot_Kind kind) {
+    assert(template->slots_count < IMHTTP_TEMPLATE_SLOTS_CAPACITY && "imhttp_template: too many slots");
+    template->slots[template->slots_count++] = (ImHTTP_Template_Slot) {
+	.offset = template->size,
+	.kind = kind,
+    };
+}
+
+static void imhttp_template_request_line_end(ImHTTP_Template *template) {
+    if(template->request_line_done) return;
+    imhttp_template_write_cstr(template, " HTTP/1.1\r\n");
+    template->request_line_done = true;
+}
+
+void imhttp_template_begin(ImHTTP_Template *template, ImHTTP_Method method, const char *path) {
+    template->size = 0;
+    template->slots_count = 0;
+    template->values_count = 0;
+    template->request_line_done = false;
+    template->has_body = false;
+    template->ended = false;
+    template->out_of_memory = false;
+    imhttp_template_write_cstr(template, imhttp_method_as_cstr(method));
+    imhttp_template_write_cstr(template, " ");
+    imhttp_template_write_cstr(template, path);
+}
+
+size_t imhttp_template_path_slot(ImHTTP_Template *template) {
+    assert(!template->request_line_done && "imhttp_template_path_slot: the request line is already done");
+    imhttp_template_slot(template, IMHTTP_SLOT_VALUE);
+    imhttp_template_request_line_end(template);
+    return template->values_count++;
+}
+
+void imhttp_template_header(ImHTTP_Template *template, const char *header_name, const char *header_value) {
+    imhttp_template_request_line_end(template);
+    imhttp_template_write_cstr(template, header_name);
+    imhttp_template_write_cstr(template, ": ");
+    imhttp_template_write_cstr(template, header_value);
+    imhttp_template_write_cstr(template, "\r\n");
+}
+
+size_t imhttp_template_header_slot(ImHTTP_Template *template, const char *header_name) {
+    imhttp_template_request_line_end(template);
+    imhttp_template_write_cstr(template, header_name);
+    imhttp_template_write_cstr(template, ": ");
+    imhttp_template_slot(template, IMHTTP_SLOT_VALUE);
+    imhttp_template_write_cstr(template, "\r\n");
+    return template->values_count++;
+}
+
+void imhttp_template_content_length(ImHTTP_Template *template) {
+    assert(!template->has_body && "imhttp_template_content_length: there is one already");
+    imhttp_template_request_line_end(template);
+    imhttp_template_write_cstr(template, "Content-Length: ");
+    imhttp_template_slot(template, IMHTTP_SLOT_CONTENT_LENGTH);
+    imhttp_template_write_cstr(template, "\r\n");
+    template->has_body = true;
 }
 
-void imhttp_req_body_chunk(ImHTTP *imhttp, const char *chunk_cstr) {
-    imhttp_write_cstr(imhttp, chunk_cstr);
+bool imhttp_template_end(ImHTTP_Template *template) {
+    imhttp_template_request_line_end(template);
+    imhttp_template_write_cstr(template, "\r\n");
+    template->ended = true;
+    return !template->out_of_memory;
 }
 
-void imhttp_req_body_chunk_sized(ImHTTP *imhttp, const char *chunk, size_t chunk_size) {
-    imhttp->write(imhttp->socket, chunk, chunk_size);
+void imhttp_template_free(ImHTTP_Template *template) {
+    const ImHTTP_Allocator allocator = template->allocator;
+    imhttp_allocator_resize(&allocator, template->data, template->capacity, 0);
+    *template = (ImHTTP_Template) { .allocator = allocator };
 }
 
-void imhttp_req_end(ImHTTP *imhttp) {
-    (void) imhttp;
+bool imhttp_req_template(ImHTTP *imhttp, const ImHTTP_Template *template,
+			 const String_View *values, const char *body, size_t body_size) {
+    assert(template->ended && "imhttp_req_template: call imhttp_template_end() first");
+    assert((body_size == 0 || template->has_body) && "imhttp_req_template: the template has no Content-Length slot");
+    if(template->out_of_memory) return false;
+    IMHTTP_STATS_MARK(imhttp, IMHTTP_PHASE_REQ_BEGIN);
+
+    char content_length[21];
+    size_t content_length_size = template->has_body ? imhttp_u64_to_cstr(body_size, content_length) : 0;
+
+    // * What is staged, a fixed piece before every slot, the slots, the last piece and the body
+    ImHTTP_Iovec iov[2 * IMHTTP_TEMPLATE_SLOTS_CAPACITY + 3];
+    int iovcnt = 0;
+    if(imhttp->req_buffer_size > 0) {
+	iov[iovcnt++] = (ImHTTP_Iovec) { .base = imhttp->req_buffer, .len = imhttp->req_buffer_size };
+    }
+    const int first = iovcnt;
+
+    size_t from = 0;
+    size_t value = 0;
+    for(size_t i = 0; i < template->slots_count; ++i) {
+	const ImHTTP_Template_Slot *slot = &template->slots[i];
+	iov[iovcnt++] = (ImHTTP_Iovec) { .base = template->data + from, .len = slot->offset - from };
+	if(slot->kind == IMHTTP_SLOT_VALUE) {
+	    iov[iovcnt++] = (ImHTTP_Iovec) { .base = values[value].data, .len = values[value].count };
+	    value += 1;
+	} else {
+	    iov[iovcnt++] = (ImHTTP_Iovec) { .base = content_length, .len = content_length_size };
+	}
+	from = slot->offset;
+    }
+    iov[iovcnt++] = (ImHTTP_Iovec) { .base = template->data + from, .len = template->size - from };
+    if(body_size > 0) {
+	iov[iovcnt++] = (ImHTTP_Iovec) { .base = body, .len = body_size };
+    }
+
+    bool ok = true;
+    if(imhttp->pipelining || imhttp->writev == NULL) {
+	for(int i = first; ok && i < iovcnt; ++i) {
+	    ok = imhttp_req_write(imhttp, iov[i].base, iov[i].len);
+	}
+    } else {
+	imhttp->req_buffer_size = 0;
+	ok = imhttp_writev_all(imhttp, iov, iovcnt);
+    }
+    if(!ok) {
+	// * Counted like a request imhttp_req_end() could not send
+	imhttp->requests_in_flight += 1;
+	return false;
+    }
+    return imhttp_req_end(imhttp);
 }
 
 // * Response Handling Code
 
-// * Moves the ownership from rollin_buffer to user_buffer
+// * Consumes the rollin_buffer up to `end` and returns the consumed part.
+// * The returned view aliases rollin_buffer, no bytes are copied.
 static String_View imhttp_shift_rollin_buffer(ImHTTP *imhttp, const char *end) {
 
     // * Boundary checks
-    assert(end >= imhttp->rollin_buffer);
-    size_t n = end - imhttp->rollin_buffer;
+    const char *begin = imhttp->rollin_buffer + imhttp->rollin_buffer_head;
+    assert(end >= begin);
+    size_t n = end - begin;
     assert(n <= imhttp->rollin_buffer_size);
 
-    // * Copy chunk to user buffer
-    assert(n <= IMHTTP_USER_BUFFER_CAPACITY);
-    memcpy(imhttp->user_buffer, imhttp->rollin_buffer, n);
+    String_View result = {
+	.data = (char *) begin,
+	.count = n
+    };
 
-    // * Shifting the rollin buffer
+    imhttp->rollin_buffer_head += n;
+    if(imhttp->rollin_buffer_head >= imhttp->rollin_buffer_capacity) {
+	// * Only mirrored rings can get here
+	imhttp->rollin_buffer_head -= imhttp->rollin_buffer_capacity;
+    }
     imhttp->rollin_buffer_size -= n;
-    memmove(imhttp->rollin_buffer, end, imhttp->rollin_buffer_size);
 
-    return (String_View) {
-	.data = imhttp->user_buffer,
-	.count = n
-    };
+    return result;
+}
+
+static bool imhttp_rollin_buffer_init(ImHTTP *imhttp) {
+    if(imhttp->rollin_buffer != NULL) return true;
+
+    imhttp_config_defaults(&imhttp->config);
+    ImHTTP_Buffer_Pool *pool = imhttp->config.rollin_pool;
+    if(pool != NULL) {
+	char *buffer = imhttp_buffer_pool_borrow(pool);
+	if(buffer != NULL) {
+	    imhttp_set_rollin_buffer(imhttp, buffer, pool->buffer_size, false);
+	    imhttp->rollin_buffer_pooled = true;
+	    return true;
+	}
+    }
+
+    const size_t capacity = pool != NULL ? pool->buffer_size : imhttp->config.rollin_capacity;
+    char *buffer = imhttp_resize(imhttp, NULL, 0, capacity);
+    if(buffer == NULL) return false;
+
+    imhttp_set_rollin_buffer(imhttp, buffer, capacity, false);
+    imhttp->rollin_buffer_owned = true;
+    return true;
+}
+
+// * With a pool the receive buffer is only held while it has unconsumed
+// * (or pinned) bytes. The views handed out by the previous call are gone
+// * by the time this is called.
+static void imhttp_rollin_buffer_release(ImHTTP *imhttp) {
+    if(imhttp->config.rollin_pool == NULL) return;
+    if(!imhttp->rollin_buffer_pooled && !imhttp->rollin_buffer_owned) return;
+    if(imhttp->rollin_buffer_size > 0 || imhttp->rollin_pinned > 0) return;
+    if(imhttp->rollin_receiving) return;
+
+    imhttp_rollin_buffer_drop(imhttp);
+    imhttp->rollin_buffer = NULL;
+    imhttp->rollin_buffer_capacity = 0;
+    imhttp->rollin_buffer_head = 0;
+}
+
+// * Only for the allocated, pooled or spilling buffer. The bytes keep their
+// * offsets, except that the unconsumed ones are moved right after the
+// * pinned block if they would not fit otherwise. Pool buffers have a fixed
+// * size and the other ones are not ours, so the bytes move to an allocated one.
+static bool imhttp_rollin_buffer_resize(ImHTTP *imhttp, size_t capacity) {
+    assert((imhttp->rollin_buffer_owned || imhttp->rollin_buffer_pooled || imhttp->rollin_buffer_spill)
+	   && !imhttp->rollin_buffer_mirrored);
+    const size_t base = imhttp->rollin_pinned;
+    if(base + imhttp->rollin_buffer_size > capacity) return false;
+
+    if(imhttp->rollin_buffer_head + imhttp->rollin_buffer_size > capacity) {
+	memmove(imhttp->rollin_buffer + base,
+		imhttp->rollin_buffer + imhttp->rollin_buffer_head,
+		imhttp->rollin_buffer_size);
+	IMHTTP_COUNT_COPY(imhttp, imhttp->rollin_buffer_size);
+	imhttp->rollin_buffer_head = base;
+    }
+
+    // * The indexed header block lives in the pinned part
+    ImHTTP_Header_Index *index = imhttp->header_index;
+    const size_t block_offset = index != NULL && index->block != NULL ? (size_t) (index->block - imhttp->rollin_buffer) : 0;
+
+    char *buffer = NULL;
+    if(!imhttp->rollin_buffer_owned) {
+	buffer = imhttp_resize(imhttp, NULL, 0, capacity);
+	if(buffer == NULL) return false;
+	const size_t used = imhttp->rollin_buffer_head + imhttp->rollin_buffer_size;
+	memcpy(buffer, imhttp->rollin_buffer, used);
+	IMHTTP_COUNT_COPY(imhttp, used);
+	imhttp_rollin_buffer_drop(imhttp);
+	imhttp->rollin_buffer_owned = true;
+    } else {
+	buffer = imhttp_resize(imhttp, imhttp->rollin_buffer, imhttp->rollin_buffer_capacity, capacity);
+	if(buffer == NULL) return false;
+    }
+
+    if(index != NULL && index->block != NULL) {
+	index->block = buffer + block_offset;
+    }
+    imhttp->rollin_buffer = buffer;
+    imhttp->rollin_buffer_capacity = capacity;
+    return true;
 }
 
-static void imhttp_top_rollin_buffer(ImHTTP *imhttp) {
+size_t imhttp_res_feed_reserve(ImHTTP *imhttp, char **dst) {
+    if(!imhttp_rollin_buffer_init(imhttp)) {
+	*dst = NULL;
+	return 0;
+    }
+    const size_t capacity = imhttp->rollin_buffer_capacity;
+
+    const size_t base = imhttp->rollin_pinned;
     if(imhttp->rollin_buffer_size == 0) {
-    // if(imhttp->rollin_buffer_size < IMHTTP_ROLLIN_BUFFER_CAPACITY) {
-	size_t n = imhttp->read(
-	               imhttp->socket,
-		       imhttp->rollin_buffer + imhttp->rollin_buffer_size,		     
-		       IMHTTP_ROLLIN_BUFFER_CAPACITY - imhttp->rollin_buffer_size);
+	imhttp->rollin_buffer_head = base;
+    }
 
-        // printf("n = %ld\n", n);
-	assert(n > 0);	       
-	imhttp->rollin_buffer_size += n;
+    size_t tail = imhttp->rollin_buffer_head + imhttp->rollin_buffer_size;
+    size_t avail = 0;
+    if(imhttp->rollin_buffer_mirrored && base == 0) {
+	// * The mirror makes [tail, tail + free) contiguous even across the end
+	if(tail >= capacity) tail -= capacity;
+	avail = capacity - imhttp->rollin_buffer_size;
+    } else {
+	if(tail == capacity && imhttp->rollin_buffer_head > base) {
+	    // * Happens once per trip around the ring and moves at most one incomplete line
+	    memmove(imhttp->rollin_buffer + base,
+		    imhttp->rollin_buffer + imhttp->rollin_buffer_head,
+		    imhttp->rollin_buffer_size);
+	    IMHTTP_COUNT_COPY(imhttp, imhttp->rollin_buffer_size);
+	    imhttp->rollin_buffer_head = base;
+	    tail = base + imhttp->rollin_buffer_size;
+	}
+	avail = capacity - tail;
+    }
+
+    *dst = imhttp->rollin_buffer + tail;
+    return avail;
+}
+
+void imhttp_res_feed_commit(ImHTTP *imhttp, size_t size) {
+    assert(imhttp->rollin_buffer_size + size <= imhttp->rollin_buffer_capacity);
+    imhttp->rollin_buffer_size += size;
+    IMHTTP_STATS_MARK(imhttp, IMHTTP_PHASE_FIRST_BYTE);
+    IMHTTP_STATS_ADD(imhttp, bytes_read, size);
+    IMHTTP_STATS_ADD(imhttp, refills, 1);
+}
+
+size_t imhttp_res_feed(ImHTTP *imhttp, const void *data, size_t size) {
+    size_t fed = 0;
+    while(fed < size) {
+	char *dst = NULL;
+	size_t avail = imhttp_res_feed_reserve(imhttp, &dst);
+	if(avail == 0) break;
+	if(avail > size - fed) avail = size - fed;
+	memcpy(dst, (const char *) data + fed, avail);
+	IMHTTP_COUNT_COPY(imhttp, avail);
+	imhttp_res_feed_commit(imhttp, avail);
+	fed += avail;
+    }
+    return fed;
+}
+
+void imhttp_res_feed_eof(ImHTTP *imhttp) {
+    imhttp->rollin_eof = true;
+}
+
+typedef enum {
+    IMHTTP_FILL_OK,
+    IMHTTP_FILL_AGAIN,
+    IMHTTP_FILL_EOF,
+    IMHTTP_FILL_FULL,
+    IMHTTP_FILL_ERROR,
+} ImHTTP_Fill;
+
+// * Reads more bytes into the free part of the ring
+static ImHTTP_Fill imhttp_fill_rollin_buffer(ImHTTP *imhttp) {
+    char *dst = NULL;
+    size_t avail = imhttp_res_feed_reserve(imhttp, &dst);
+    if(avail == 0) {
+	// * Full of unconsumed bytes, only the parser asking for more grows it
+	size_t capacity = imhttp->rollin_buffer_capacity;
+	const bool resizable = imhttp->rollin_buffer_owned
+	    || imhttp->rollin_buffer_pooled
+	    || (imhttp->rollin_buffer_spill && !imhttp->rollin_buffer_mirrored);
+	if(!resizable || capacity >= imhttp->config.rollin_max_capacity) {
+	    return IMHTTP_FILL_FULL;
+	}
+	capacity = capacity * 2 < imhttp->config.rollin_max_capacity ? capacity * 2 : imhttp->config.rollin_max_capacity;
+	if(!imhttp_rollin_buffer_resize(imhttp, capacity)) return IMHTTP_FILL_FULL;
+	avail = imhttp_res_feed_reserve(imhttp, &dst);
+	assert(avail > 0);
+    }
+
+    // * Push mode, the bytes come from imhttp_res_feed()
+    if(imhttp->read == NULL) {
+	if(imhttp->rollin_eof) return IMHTTP_FILL_EOF;
+	imhttp_rollin_buffer_release(imhttp);
+	return IMHTTP_FILL_AGAIN;
+    }
+
+    for(;;) {
+	ssize_t n = imhttp->read(imhttp->socket, dst, avail);
+	// printf("n = %ld\n", n);
+	IMHTTP_STATS_ADD(imhttp, reads, 1);
+	if(n > 0) {
+	    imhttp->rollin_buffer_size += n;
+	    IMHTTP_STATS_MARK(imhttp, IMHTTP_PHASE_FIRST_BYTE);
+	    IMHTTP_STATS_ADD(imhttp, bytes_read, n);
+	    IMHTTP_STATS_ADD(imhttp, refills, 1);
+	    return IMHTTP_FILL_OK;
+	}
+	if(n == 0) return IMHTTP_FILL_EOF;
+	if(errno == EINTR) continue;
+	if(errno == EAGAIN || errno == EWOULDBLOCK) {
+	    imhttp_rollin_buffer_release(imhttp);
+	    return IMHTTP_FILL_AGAIN;
+	}
+	return IMHTTP_FILL_ERROR;
     }
 }
 
 static String_View imhttp_rollin_buffer_as_sv(ImHTTP *imhttp) {
     return (String_View) {
-	.data = imhttp->rollin_buffer,
+	.data = imhttp->rollin_buffer + imhttp->rollin_buffer_head,
 	.count = imhttp->rollin_buffer_size,
     };
 }
 
+static ImHTTP_Result imhttp_res_fail(ImHTTP *imhttp, const char *reason) {
+    imhttp->res_state = IMHTTP_RES_ERROR;
+    imhttp->res_error = reason;
+    imhttp->keep_alive = false;
+    return IMHTTP_ERROR;
+}
+
+// * Maps the outcome of a fill that could not produce the bytes we were waiting for
+static ImHTTP_Result imhttp_res_fill_failed(ImHTTP *imhttp, ImHTTP_Fill fill) {
+    switch(fill) {
+    case IMHTTP_FILL_AGAIN: return IMHTTP_AGAIN;
+    case IMHTTP_FILL_EOF:   return imhttp_res_fail(imhttp, "The connection was closed in the middle of the response");
+    case IMHTTP_FILL_FULL:  return imhttp_res_fail(imhttp, "The line does not fit into the rolling buffer");
+    case IMHTTP_FILL_ERROR: return imhttp_res_fail(imhttp, "Could not read from the socket");
+    case IMHTTP_FILL_OK:
+    default:
+	assert(0 && "imhttp_res_fill_failed: unreachable");
+	return IMHTTP_ERROR;
+    }
+}
+
+// * Consumes the next \r\n terminated line. The returned line does not
+// * include the \r\n. The scan resumes where the previous IMHTTP_AGAIN
+// * left off, so every byte is looked at once no matter how it trickles in.
+static ImHTTP_Result imhttp_res_poll_line(ImHTTP *imhttp, String_View *line) {
+    for(;;) {
+	String_View rollin = imhttp_rollin_buffer_as_sv(imhttp);
+	String_View unscanned = {
+	    .data = rollin.data + imhttp->line_scanned,
+	    .count = rollin.count - imhttp->line_scanned,
+	};
+	size_t i = 0;
+	if(sv_find_crlf(unscanned, &i)) {
+	    *line = imhttp_shift_rollin_buffer(imhttp, unscanned.data + i + 2);
+	    line->count -= 2;
+	    imhttp->line_scanned = 0;
+	    return IMHTTP_OK;
+	}
+	// * The last byte may be a \r whose \n has not arrived yet
+	imhttp->line_scanned = rollin.count > 0 ? rollin.count - 1 : 0;
+
+	ImHTTP_Fill fill = imhttp_fill_rollin_buffer(imhttp);
+	if(fill != IMHTTP_FILL_OK) return imhttp_res_fill_failed(imhttp, fill);
+    }
+}
+
+void imhttp_set_rollin_buffer(ImHTTP *imhttp, char *buffer, size_t capacity, bool mirrored) {
+    assert(imhttp->rollin_buffer_size == 0);
+    imhttp_rollin_buffer_drop(imhttp);
+    imhttp->rollin_buffer = buffer;
+    imhttp->rollin_buffer_capacity = capacity;
+    imhttp->rollin_buffer_mirrored = mirrored;
+    imhttp->rollin_buffer_head = 0;
+}
+
 void imhttp_res_begin(ImHTTP *imhttp) {
-    // * Reset the content_length
+    imhttp_rollin_buffer_init(imhttp);
+
+    // * Reset everything that belongs to the previous response.
+    // * Unconsumed bytes in rollin_buffer are kept, they belong to the next one.
+    imhttp->res_state = IMHTTP_RES_STATUS;
+    imhttp->res_error = NULL;
+    imhttp->line_scanned = 0;
+    imhttp->rollin_pinned = 0;
+    imhttp->header_cursor = 0;
+    if(imhttp->header_index != NULL) {
+	imhttp->header_index->block = NULL;
+	imhttp->header_index->count = 0;
+    }
+    // * Back to the small buffer after a bulk body (or a huge header block)
+    if(imhttp->config.rollin_pool != NULL) {
+	imhttp_rollin_buffer_release(imhttp);
+    } else if(imhttp->rollin_buffer_owned
+       && !imhttp->rollin_receiving
+       && imhttp->rollin_buffer_capacity > imhttp->config.rollin_capacity
+       && imhttp->rollin_buffer_size <= imhttp->config.rollin_capacity) {
+	imhttp_rollin_buffer_resize(imhttp, imhttp->config.rollin_capacity);
+    }
+    imhttp->status_code = 0;
     imhttp->content_length = -1;
     imhttp->chunked = false;
-}
+    imhttp->chunk_state = IMHTTP_CHUNK_SIZE;
+    imhttp->chunk_remaining = 0;
+    imhttp->content_encoding = IMHTTP_ENCODING_IDENTITY;
+    imhttp->decoding = false;
+    imhttp->keep_alive = false;
 
-// * Get the status code from response
-uint64_t imhttp_res_status_code(ImHTTP *imhttp) {
-    imhttp_top_rollin_buffer(imhttp);
-    String_View rollin = imhttp_rollin_buffer_as_sv(imhttp);
+    IMHTTP_STATS_MARK(imhttp, IMHTTP_PHASE_RES_BEGIN);
+    if(imhttp->rollin_buffer_size > 0) {
+	IMHTTP_STATS_MARK(imhttp, IMHTTP_PHASE_FIRST_BYTE);
+    }
+}
 
-    String_View status_line = sv_chop_by_delim(&rollin, '\n');
-    // SV_PRINT(status_line);    
-    assert(
-	 sv_ends_with(status_line, cstr_to_sv("\r")) &&
-	 "The rolling buffer is so small that it could not fit the whole status line."    
-	 "Or maybe the status line was not fully read after the imhttp_top_rollin_buffer()"
-	 "above");
-
-    status_line = imhttp_shift_rollin_buffer(imhttp, rollin.data);
-    // * TODO: HTTP version is skipped in imhttp_res_status_code
-    sv_chop_by_delim(&status_line, ' ');
+static ImHTTP_Result imhttp_res_parse_status_line(ImHTTP *imhttp, String_View status_line) {
+    // SV_PRINT(status_line);
+    String_View version = sv_chop_by_delim(&status_line, ' ');
     String_View code_sv = sv_chop_by_delim(&status_line, ' ');
     // SV_PRINT(code_sv);
 
-    return sv_to_u64(code_sv);
+    if(!sv_starts_with(version, cstr_to_sv("HTTP/")) || code_sv.count != 3) {
+	return imhttp_res_fail(imhttp, "Invalid status line");
+    }
+
+    if(sv_parse_u64(code_sv, &imhttp->status_code) != SV_PARSE_OK) {
+	return imhttp_res_fail(imhttp, "Invalid status line");
+    }
+    // * HTTP/1.1 is persistent by default, HTTP/1.0 is not
+    imhttp->keep_alive = sv_eq(version, cstr_to_sv("HTTP/1.1"));
+    imhttp->res_state = IMHTTP_RES_HEADERS;
+    return IMHTTP_OK;
 }
 
-bool imhttp_res_next_header(ImHTTP *imhttp, String_View *name, String_View *value) {
-    imhttp_top_rollin_buffer(imhttp);    
+// * Perfect hash over (length, first, last). The constants were brute forced
+// * so that every name in IMHTTP_HEADERS gets a slot of its own. A collision
+// * after adding a header shows up as -Woverride-init ("initialized field
+// * overwritten", part of -Wextra) on imhttp_header_table. A wrong `first`
+// * or `last` does not collide, the header is just never found: the bench
+// * looks every name up at startup to catch that.
+#define IMHTTP_HEADER_TABLE_SIZE 64
+#define IMHTTP_HEADER_HASH(length, first, last) \
+    (((size_t) (length) * 2 + (size_t) (first) * 46 + (size_t) (last) * 25) & (IMHTTP_HEADER_TABLE_SIZE - 1))
+
+typedef struct {
+    ImHTTP_Header header;
+    size_t length;
+} ImHTTP_Header_Slot;
+
+static const ImHTTP_Header_Slot imhttp_header_table[IMHTTP_HEADER_TABLE_SIZE] = {
+#define IMHTTP_HEADER_SLOT(id, name, first, last) \
+    [IMHTTP_HEADER_HASH(sizeof(name) - 1, first, last)] = { IMHTTP_HDR_##id, sizeof(name) - 1 },
+    IMHTTP_HEADERS(IMHTTP_HEADER_SLOT)
+#undef IMHTTP_HEADER_SLOT
+};
+
+static const char *const imhttp_header_names[IMHTTP_HDR_COUNT] = {
+#define IMHTTP_HEADER_NAME(id, name, first, last) [IMHTTP_HDR_##id] = name,
+    IMHTTP_HEADERS(IMHTTP_HEADER_NAME)
+#undef IMHTTP_HEADER_NAME
+};
+
+ImHTTP_Header imhttp_header_lookup(String_View name) {
+    if(name.count == 0) return IMHTTP_HDR_UNKNOWN;
+
+    // * Only letters matter here, the full compare below sorts out the rest
+    const unsigned char first = name.data[0] | 0x20;
+    const unsigned char last = name.data[name.count - 1] | 0x20;
+    const ImHTTP_Header_Slot *slot = &imhttp_header_table[IMHTTP_HEADER_HASH(name.count, first, last)];
+    if(slot->header == IMHTTP_HDR_UNKNOWN || slot->length != name.count) return IMHTTP_HDR_UNKNOWN;
+
+    String_View known = {
+	.count = slot->length,
+	.data = (char *) imhttp_header_names[slot->header],
+    };
+    return sv_eq_ignorecase(name, known) ? slot->header : IMHTTP_HDR_UNKNOWN;
+}
+
+const char *imhttp_header_name(ImHTTP_Header header) {
+    assert(header < IMHTTP_HDR_COUNT);
+    return imhttp_header_names[header];
+}
+
+// * Picks up the fields that matter for the framing and the connection
+static ImHTTP_Result imhttp_res_apply_header(ImHTTP *imhttp, const ImHTTP_Event *event) {
+    switch(event->header) {
+    case IMHTTP_HDR_CONTENT_LENGTH: {
+	uint64_t length;
+	Sv_Parse_Result parsed = sv_parse_u64(event->value, &length);
+	if(parsed == SV_PARSE_OVERFLOW || (parsed == SV_PARSE_OK && length > INT64_MAX)) {
+	    return imhttp_res_fail(imhttp, "The Content-Length is too big");
+	}
+	if(parsed != SV_PARSE_OK) {
+	    return imhttp_res_fail(imhttp, "Invalid Content-Length");
+	}
+	imhttp->content_length = length;
+    } break;
+
+    case IMHTTP_HDR_TRANSFER_ENCODING: {
+	// There can be multiple ',' separated transfer encodings
+	String_View encoding_list = event->value;
+	while(encoding_list.count > 0) {
+	    String_View encoding = sv_chop_by_delim(&encoding_list, ',');
+	    sv_trim(&encoding);
+	    if(sv_eq_ignorecase(encoding, cstr_to_sv("chunked"))) {
+		imhttp->chunked = true;
+	    }
+	}
+    } break;
+
+    case IMHTTP_HDR_CONTENT_ENCODING: {
+	String_View encoding = event->value;
+	sv_trim(&encoding);
+	if(encoding.count == 0 || sv_eq_ignorecase(encoding, cstr_to_sv("identity"))) {
+	    imhttp->content_encoding = IMHTTP_ENCODING_IDENTITY;
+	} else if(sv_eq_ignorecase(encoding, cstr_to_sv("gzip")) || sv_eq_ignorecase(encoding, cstr_to_sv("x-gzip"))) {
+	    imhttp->content_encoding = IMHTTP_ENCODING_GZIP;
+	} else if(sv_eq_ignorecase(encoding, cstr_to_sv("deflate"))) {
+	    imhttp->content_encoding = IMHTTP_ENCODING_DEFLATE;
+	} else {
+	    imhttp->content_encoding = IMHTTP_ENCODING_OTHER;
+	}
+    } break;
+
+    case IMHTTP_HDR_CONNECTION: {
+	String_View option_list = event->value;
+	while(option_list.count > 0) {
+	    String_View option = sv_chop_by_delim(&option_list, ',');
+	    sv_trim(&option);
+	    if(sv_eq_ignorecase(option, cstr_to_sv("close"))) {
+		imhttp->keep_alive = false;
+	    } else if(sv_eq_ignorecase(option, cstr_to_sv("keep-alive"))) {
+		imhttp->keep_alive = true;
+	    }
+	}
+    } break;
+
+    default:
+	break;
+    }
+    return IMHTTP_OK;
+}
+
+static ImHTTP_Result imhttp_res_parse_header(ImHTTP *imhttp, String_View header_line, ImHTTP_Event *event) {
+    event->name = sv_chop_by_delim(&header_line, ':');
+    sv_trim(&header_line);
+    event->value = header_line;
+    event->header = imhttp_header_lookup(event->name);
+    return imhttp_res_apply_header(imhttp, event);
+}
+
+#ifdef IMHTTP_ZLIB
+// * Gzip or zlib, told apart by their headers
+#define IMHTTP_DECODER_WINDOW_BITS (15 + 32)
+
+static bool imhttp_decoder_start(ImHTTP_Decoder *decoder) {
+    decoder->finished = false;
+    decoder->window_full = false;
+    decoder->sniff_count = 0;
+    if(decoder->initialized) {
+	return inflateReset2(&decoder->stream, IMHTTP_DECODER_WINDOW_BITS) == Z_OK;
+    }
+    decoder->stream = (z_stream) {0};
+    decoder->initialized = inflateInit2(&decoder->stream, IMHTTP_DECODER_WINDOW_BITS) == Z_OK;
+    return decoder->initialized;
+}
+
+void imhttp_res_decode(ImHTTP *imhttp, ImHTTP_Decoder *decoder) {
+    imhttp->decoder = decoder;
+}
+
+void imhttp_decoder_free(ImHTTP_Decoder *decoder) {
+    if(decoder->initialized) inflateEnd(&decoder->stream);
+    decoder->initialized = false;
+}
+#endif
+
+// * Called once the empty line after the headers is consumed
+static void imhttp_res_headers_done(ImHTTP *imhttp) {
+    // * These never have a body no matter what the headers say
+    // * https://www.rfc-editor.org/rfc/rfc9112#section-6.3
+    uint64_t code = imhttp->status_code;
+    if((code >= 100 && code < 200) || code == 204 || code == 304) {
+	imhttp->content_length = 0;
+	imhttp->chunked = false;
+    }
+
+    // * Transfer-Encoding overrides Content-Length
+    if(imhttp->chunked) {
+	imhttp->content_length = -1;
+    }
+
+#ifdef IMHTTP_ZLIB
+    if(imhttp->decoder != NULL
+       && (imhttp->content_encoding == IMHTTP_ENCODING_GZIP || imhttp->content_encoding == IMHTTP_ENCODING_DEFLATE)
+       && imhttp->content_length != 0) {
+	if(imhttp_decoder_start(imhttp->decoder)) {
+	    imhttp->decoder->sniff_raw_deflate = imhttp->content_encoding == IMHTTP_ENCODING_DEFLATE;
+	    imhttp->decoding = true;
+	} else {
+	    // * Out of memory. The body is still handed out, undecoded.
+	    imhttp->content_encoding = IMHTTP_ENCODING_OTHER;
+	}
+    }
+#endif
+
+    // * No framing at all means the body ends when the server closes the connection
+    if(!imhttp->chunked && imhttp->content_length < 0) {
+	imhttp->keep_alive = false;
+    }
+
+    // * Bulk bodies are read in big gulps. Failing to grow is fine.
+    if((imhttp->rollin_buffer_owned || imhttp->rollin_buffer_pooled)
+       && imhttp->config.body_capacity > imhttp->rollin_buffer_capacity
+       && (imhttp->content_length < 0 || (uint64_t) imhttp->content_length > imhttp->rollin_buffer_capacity)) {
+	imhttp_rollin_buffer_resize(imhttp, imhttp->config.body_capacity);
+    }
+
+    imhttp->res_state = IMHTTP_RES_BODY;
+    IMHTTP_STATS_MARK(imhttp, IMHTTP_PHASE_HEADERS_END);
+}
+
+void imhttp_res_index_headers(ImHTTP *imhttp, ImHTTP_Header_Index *index) {
+    imhttp->header_index = index;
+    if(index != NULL) {
+	index->block = NULL;
+	index->count = 0;
+    }
+}
+
+static void imhttp_reverse(char *begin, char *end) {
+    while(begin + 1 < end) {
+	char c = *begin;
+	*begin++ = *--end;
+	*end = c;
+    }
+}
+
+// * Pinning the block must leave at least this much of the ring for the body
+#define IMHTTP_PIN_MIN_ROOM(capacity) ((capacity) / 4)
+
+// * Waits for the complete header block, pins it at the front of the ring
+// * and parses all of its fields into the index
+static ImHTTP_Result imhttp_res_index_header_block(ImHTTP *imhttp) {
+    size_t block_size = 0;
+    for(;;) {
+	String_View rollin = imhttp_rollin_buffer_as_sv(imhttp);
+	if(rollin.count >= 2 && rollin.data[0] == '\r' && rollin.data[1] == '\n') {
+	    block_size = 2;
+	    break;
+	}
+	String_View unscanned = {
+	    .data = rollin.data + imhttp->line_scanned,
+	    .count = rollin.count - imhttp->line_scanned,
+	};
+	size_t i = 0;
+	if(sv_find_crlfcrlf(unscanned, &i)) {
+	    block_size = imhttp->line_scanned + i + 4;
+	    break;
+	}
+	// * The last 3 bytes may be the beginning of a \r\n\r\n
+	imhttp->line_scanned = rollin.count > 3 ? rollin.count - 3 : 0;
+
+	ImHTTP_Fill fill = imhttp_fill_rollin_buffer(imhttp);
+	if(fill == IMHTTP_FILL_FULL) {
+	    return imhttp_res_fail(imhttp, "The header block does not fit into the rolling buffer");
+	}
+	if(fill != IMHTTP_FILL_OK) return imhttp_res_fill_failed(imhttp, fill);
+    }
+    imhttp->line_scanned = 0;
+
+    char *buffer = imhttp->rollin_buffer;
+    const size_t capacity = imhttp->rollin_buffer_capacity;
+    size_t head = imhttp->rollin_buffer_head;
+    const size_t size = imhttp->rollin_buffer_size;
+    if((imhttp->rollin_buffer_mirrored && head + size > capacity)
+       || (head > 0 && capacity - (head + block_size) < IMHTTP_PIN_MIN_ROOM(capacity))) {
+	// * Rarely needed: the pinned part must not wrap and must leave room for the body
+	if(imhttp->rollin_buffer_mirrored) {
+	    // * Rotates the whole ring left by `head`
+	    imhttp_reverse(buffer, buffer + head);
+	    imhttp_reverse(buffer + head, buffer + capacity);
+	    imhttp_reverse(buffer, buffer + capacity);
+	    IMHTTP_COUNT_COPY(imhttp, 2 * capacity);
+	} else {
+	    memmove(buffer, buffer + head, size);
+	    IMHTTP_COUNT_COPY(imhttp, size);
+	}
+	head = 0;
+	imhttp->rollin_buffer_head = 0;
+    }
+
+    String_View block = imhttp_shift_rollin_buffer(imhttp, buffer + head + block_size);
+    imhttp->rollin_pinned = head + block_size;
+
+    ImHTTP_Header_Index *index = imhttp->header_index;
+    index->block = block.data;
+    index->count = 0;
+    memset(index->first, 0xff, sizeof(index->first));
+
+    String_View line;
+    while(sv_chop_line(&block, &line) && line.count > 0) {
+	if(index->count >= IMHTTP_HEADER_INDEX_CAPACITY) {
+	    return imhttp_res_fail(imhttp, "Too many header fields for the header index");
+	}
+
+	ImHTTP_Event field;
+	ImHTTP_Result result = imhttp_res_parse_header(imhttp, line, &field);
+	if(result != IMHTTP_OK) return result;
+
+	ImHTTP_Header_Entry *entry = &index->entries[index->count];
+	entry->header = field.header;
+	entry->name_length = field.name.count;
+	entry->name_offset = field.name.data - index->block;
+	entry->value_offset = field.value.data - index->block;
+	entry->value_length = field.value.count;
+	if(field.header != IMHTTP_HDR_UNKNOWN && index->first[field.header] < 0) {
+	    index->first[field.header] = index->count;
+	}
+	index->count += 1;
+    }
+    return IMHTTP_OK;
+}
+
+// * IMHTTP_RES_HEADERS with an index: the fields are handed out from it
+static ImHTTP_Result imhttp_res_poll_indexed_header(ImHTTP *imhttp, ImHTTP_Event *event) {
+    ImHTTP_Header_Index *index = imhttp->header_index;
+    if(index->block == NULL) {
+	ImHTTP_Result result = imhttp_res_index_header_block(imhttp);
+	if(result != IMHTTP_OK) return result;
+    }
+
+    if(imhttp->header_cursor < index->count) {
+	imhttp_res_header_at(imhttp, imhttp->header_cursor, &event->name, &event->value);
+	event->header = index->entries[imhttp->header_cursor].header;
+	event->kind = IMHTTP_EVENT_HEADER;
+	imhttp->header_cursor += 1;
+	return IMHTTP_OK;
+    }
+
+    imhttp_res_headers_done(imhttp);
+    event->kind = IMHTTP_EVENT_HEADERS_END;
+    return IMHTTP_OK;
+}
+
+String_View imhttp_res_header_get(ImHTTP *imhttp, ImHTTP_Header header) {
+    String_View value = {0};
+    const ImHTTP_Header_Index *index = imhttp->header_index;
+    if(index == NULL || index->block == NULL || header == IMHTTP_HDR_UNKNOWN) return value;
+
+    assert(header < IMHTTP_HDR_COUNT);
+    int16_t i = index->first[header];
+    if(i < 0) return value;
+
+    value.data = (char *) index->block + index->entries[i].value_offset;
+    value.count = index->entries[i].value_length;
+    return value;
+}
+
+size_t imhttp_res_header_count(ImHTTP *imhttp) {
+    const ImHTTP_Header_Index *index = imhttp->header_index;
+    if(index == NULL || index->block == NULL) return 0;
+    return index->count;
+}
+
+void imhttp_res_header_at(ImHTTP *imhttp, size_t i, String_View *name, String_View *value) {
+    const ImHTTP_Header_Index *index = imhttp->header_index;
+    assert(index != NULL && index->block != NULL && i < index->count);
+    const ImHTTP_Header_Entry *entry = &index->entries[i];
+    name->data = (char *) index->block + entry->name_offset;
+    name->count = entry->name_length;
+    value->data = (char *) index->block + entry->value_offset;
+    value->count = entry->value_length;
+}
+
+// * Chunked Transfer-Encoding
+// * https://www.rfc-editor.org/rfc/rfc9112#section-7.1
+// * Payloads are handed out straight from rollin_buffer, so the memory
+// * needed does not depend on the size of the chunks or of the body.
+static ImHTTP_Result imhttp_res_poll_chunked_body(ImHTTP *imhttp, ImHTTP_Event *event) {
+    for(;;) {
+	switch(imhttp->chunk_state) {
+	case IMHTTP_CHUNK_SIZE: {
+	    String_View size_line;
+	    ImHTTP_Result result = imhttp_res_poll_line(imhttp, &size_line);
+	    if(result != IMHTTP_OK) return result;
+
+	    // * Chunk extensions are ignored
+	    String_View size_sv = sv_chop_by_delim(&size_line, ';');
+	    sv_trim(&size_sv);
+	    Sv_Parse_Result parsed = sv_parse_hex_u64(size_sv, &imhttp->chunk_remaining);
+	    if(parsed == SV_PARSE_OVERFLOW) {
+		return imhttp_res_fail(imhttp, "The chunk size is too big");
+	    }
+	    if(parsed != SV_PARSE_OK) {
+		return imhttp_res_fail(imhttp, "Invalid chunk size line");
+	    }
+
+	    if(imhttp->chunk_remaining == 0) {
+		// * The last chunk, trailers follow
+		imhttp->res_state = IMHTTP_RES_TRAILERS;
+		event->kind = IMHTTP_EVENT_BODY_END;
+		return IMHTTP_OK;
+	    }
+	    imhttp->chunk_state = IMHTTP_CHUNK_DATA;
+	} break;
+
+	case IMHTTP_CHUNK_DATA: {
+	    if(imhttp->rollin_buffer_size == 0) {
+		ImHTTP_Fill fill = imhttp_fill_rollin_buffer(imhttp);
+		if(fill != IMHTTP_FILL_OK) return imhttp_res_fill_failed(imhttp, fill);
+	    }
+
+	    String_View rollin = imhttp_rollin_buffer_as_sv(imhttp);
+	    if(rollin.count > imhttp->chunk_remaining) {
+		rollin.count = imhttp->chunk_remaining;
+	    }
+
+	    event->kind = IMHTTP_EVENT_BODY_CHUNK;
+	    event->chunk = imhttp_shift_rollin_buffer(imhttp, rollin.data + rollin.count);
+
+	    imhttp->chunk_remaining -= event->chunk.count;
+	    if(imhttp->chunk_remaining == 0) {
+		imhttp->chunk_state = IMHTTP_CHUNK_DATA_END;
+	    }
+	    return IMHTTP_OK;
+	}
+
+	case IMHTTP_CHUNK_DATA_END: {
+	    String_View empty_line;
+	    ImHTTP_Result result = imhttp_res_poll_line(imhttp, &empty_line);
+	    if(result != IMHTTP_OK) return result;
+	    if(empty_line.count != 0) {
+		return imhttp_res_fail(imhttp, "The chunk data is not terminated with \\r\\n");
+	    }
+	    imhttp->chunk_state = IMHTTP_CHUNK_SIZE;
+	} break;
+
+	default:
+	    assert(0 && "imhttp_res_poll_chunked_body: unreachable");
+	    return IMHTTP_ERROR;
+	}
+    }
+}
+
+static ImHTTP_Result imhttp_res_poll_body(ImHTTP *imhttp, ImHTTP_Event *event) {
+    if(imhttp->chunked) {
+	return imhttp_res_poll_chunked_body(imhttp, event);
+    }
+
+    if(imhttp->content_length == 0) {
+	imhttp->res_state = IMHTTP_RES_DONE;
+	IMHTTP_STATS_MARK(imhttp, IMHTTP_PHASE_BODY_END);
+	event->kind = IMHTTP_EVENT_BODY_END;
+	return IMHTTP_OK;
+    }
+
+    if(imhttp->rollin_buffer_size == 0) {
+	ImHTTP_Fill fill = imhttp_fill_rollin_buffer(imhttp);
+	if(fill == IMHTTP_FILL_EOF && imhttp->content_length < 0) {
+	    // * Only the responses without Content-Length are allowed to end like this
+	    imhttp->res_state = IMHTTP_RES_DONE;
+	    IMHTTP_STATS_MARK(imhttp, IMHTTP_PHASE_BODY_END);
+	    event->kind = IMHTTP_EVENT_BODY_END;
+	    return IMHTTP_OK;
+	}
+	if(fill != IMHTTP_FILL_OK) return imhttp_res_fill_failed(imhttp, fill);
+    }
+
     String_View rollin = imhttp_rollin_buffer_as_sv(imhttp);
     // SV_PRINT(rollin);
-    
-    String_View header_line = sv_chop_by_delim(&rollin, '\n');
-    
-    assert(
-	 sv_ends_with(header_line, cstr_to_sv("\r")) &&
-	 "The rolling buffer is so small that it could not fit the whole status line."    
-	 "Or maybe the header line was not fully read after the imhttp_top_rollin_buffer()"
-	 "above");
-
-    header_line = imhttp_shift_rollin_buffer(imhttp, rollin.data);
-
-    // * Check if we got \r\n
-    // * After \r\n we have html 
-    if(!sv_eq(header_line, cstr_to_sv("\r\n"))) {
-	*name = sv_chop_by_delim(&header_line, ':');
-	sv_trim(&header_line);
-	*value = header_line;
-	
-	if(sv_eq(*name, cstr_to_sv("Content-Length"))) {
-	    // TODO content_length overflow
-	    imhttp->content_length = sv_to_u64(*value);
-	} else if(sv_eq(*name, cstr_to_sv("Transfer-Encoding"))) {
-	    // There can be multiple ',' separated transfer encodings
-	    String_View encoding_list = *value;
-	    while(encoding_list.count > 0) {
-		String_View encoding = sv_chop_by_delim(&encoding_list, ',');
-		sv_trim(&encoding);
-		if(sv_eq(encoding, cstr_to_sv("chunked"))) {
-		    imhttp->chunked = true;
+
+    // * Never consume past the body, the rest belongs to the next response
+    if(imhttp->content_length > 0 && rollin.count > (uint64_t) imhttp->content_length) {
+	rollin.count = imhttp->content_length;
+    }
+
+    event->kind = IMHTTP_EVENT_BODY_CHUNK;
+    event->chunk = imhttp_shift_rollin_buffer(imhttp, rollin.data + rollin.count);
+
+    if(imhttp->content_length > 0) {
+	imhttp->content_length -= event->chunk.count;
+    }
+    return IMHTTP_OK;
+}
+
+#ifdef IMHTTP_ZLIB
+// * Puts the last `n` bytes of the body chunk just handed out back in front
+// * of the ring, as if they had not been consumed. Nothing can have touched
+// * them since, the ring is only refilled once it is empty.
+static void imhttp_res_unread_body(ImHTTP *imhttp, size_t n) {
+    if(n == 0) return;
+    if(imhttp->rollin_buffer_head < n) {
+	// * Only mirrored rings can get here
+	imhttp->rollin_buffer_head += imhttp->rollin_buffer_capacity;
+    }
+    imhttp->rollin_buffer_head -= n;
+    imhttp->rollin_buffer_size += n;
+
+    if(imhttp->chunked) {
+	imhttp->chunk_remaining += n;
+	imhttp->chunk_state = IMHTTP_CHUNK_DATA;
+    } else if(imhttp->content_length >= 0) {
+	imhttp->content_length += n;
+    }
+}
+
+// * Raw deflate has no header, a zlib one is a multiple of 31 with method 8
+static bool imhttp_looks_like_zlib(const char *header) {
+    const unsigned char cmf = header[0];
+    const unsigned char flg = header[1];
+    return (cmf & 0x0f) == 8 && (cmf >> 4) <= 7 && (cmf * 256 + flg) % 31 == 0;
+}
+
+static ImHTTP_Result imhttp_res_poll_decoded_body(ImHTTP *imhttp, ImHTTP_Event *event) {
+    ImHTTP_Decoder *decoder = imhttp->decoder;
+    z_stream *stream = &decoder->stream;
+
+    for(;;) {
+	stream->next_out = (Bytef *) decoder->window;
+	stream->avail_out = IMHTTP_DECODER_WINDOW_CAPACITY;
+
+	if(decoder->window_full) {
+	    // * Drains what inflate() kept before taking more input
+	    stream->next_in = Z_NULL;
+	    stream->avail_in = 0;
+	} else {
+	    ImHTTP_Event raw;
+	    ImHTTP_Result result = imhttp_res_poll_body(imhttp, &raw);
+	    if(result != IMHTTP_OK) return result;
+
+	    if(raw.kind != IMHTTP_EVENT_BODY_CHUNK) {
+		if(!decoder->finished) {
+		    return imhttp_res_fail(imhttp, "The compressed body is truncated");
+		}
+		imhttp->decoding = false;
+		*event = raw;
+		return IMHTTP_OK;
+	    }
+
+	    if(decoder->sniff_raw_deflate) {
+		const char *header = raw.chunk.data;
+		if(decoder->sniff_count == 0 && raw.chunk.count == 1) {
+		    decoder->sniff[decoder->sniff_count++] = raw.chunk.data[0];
+		    continue;
+		}
+		if(decoder->sniff_count == 1) {
+		    decoder->sniff[1] = raw.chunk.data[0];
+		    header = decoder->sniff;
+		}
+		decoder->sniff_raw_deflate = false;
+		if(!imhttp_looks_like_zlib(header) && inflateReset2(stream, -15) != Z_OK) {
+		    return imhttp_res_fail(imhttp, "Could not decode the body");
 		}
+		if(decoder->sniff_count == 1) {
+		    // * The byte held back goes first. Alone it is too short to
+		    // * produce any output or to end the stream.
+		    stream->next_in = (Bytef *) decoder->sniff;
+		    stream->avail_in = 1;
+		    int ret = inflate(stream, Z_NO_FLUSH);
+		    if(ret != Z_OK && ret != Z_BUF_ERROR) return imhttp_res_fail(imhttp, "Could not decode the body");
+		}
+	    }
+	    if(decoder->finished) {
+		// * gzip allows several members back to back
+		if(inflateReset(stream) != Z_OK) return imhttp_res_fail(imhttp, "Could not decode the body");
+		decoder->finished = false;
 	    }
+	    stream->next_in = (Bytef *) raw.chunk.data;
+	    stream->avail_in = raw.chunk.count;
 	}
-		
-	return true;
+
+	const bool draining = stream->avail_in == 0;
+	int ret = inflate(stream, Z_NO_FLUSH);
+	if(ret == Z_STREAM_END) {
+	    decoder->finished = true;
+	} else if(ret != Z_OK && !(ret == Z_BUF_ERROR && draining)) {
+	    // * Z_BUF_ERROR with input at hand means it could not make progress
+	    return imhttp_res_fail(imhttp, "Could not decode the body");
+	}
+	// * The input inflate() did not take is handed to it again next time
+	imhttp_res_unread_body(imhttp, stream->avail_in);
+	decoder->window_full = stream->avail_out == 0 && !decoder->finished;
+
+	size_t produced = IMHTTP_DECODER_WINDOW_CAPACITY - stream->avail_out;
+	if(produced > 0) {
+	    event->kind = IMHTTP_EVENT_BODY_CHUNK;
+	    event->chunk = (String_View) { .data = decoder->window, .count = produced };
+	    return IMHTTP_OK;
+	}
+    }
+}
+#endif
+
+ImHTTP_Result imhttp_res_poll(ImHTTP *imhttp, ImHTTP_Event *event) {
+    switch(imhttp->res_state) {
+    case IMHTTP_RES_STATUS: {
+	String_View status_line;
+	ImHTTP_Result result = imhttp_res_poll_line(imhttp, &status_line);
+	if(result != IMHTTP_OK) return result;
+
+	result = imhttp_res_parse_status_line(imhttp, status_line);
+	if(result != IMHTTP_OK) return result;
+
+	event->kind = IMHTTP_EVENT_STATUS;
+	event->status_code = imhttp->status_code;
+	return IMHTTP_OK;
+    }
+
+    case IMHTTP_RES_HEADERS: {
+	if(imhttp->header_index != NULL) {
+	    return imhttp_res_poll_indexed_header(imhttp, event);
+	}
+
+	String_View header_line;
+	ImHTTP_Result result = imhttp_res_poll_line(imhttp, &header_line);
+	if(result != IMHTTP_OK) return result;
+
+	// * Check if we got \r\n (an empty line)
+	// * After \r\n we have html 
+	if(header_line.count == 0) {
+	    imhttp_res_headers_done(imhttp);
+	    event->kind = IMHTTP_EVENT_HEADERS_END;
+	    return IMHTTP_OK;
+	}
+
+	event->kind = IMHTTP_EVENT_HEADER;
+	return imhttp_res_parse_header(imhttp, header_line, event);
     }
 
-    return false;
-    
+    case IMHTTP_RES_BODY:
+#ifdef IMHTTP_ZLIB
+	if(imhttp->decoding) return imhttp_res_poll_decoded_body(imhttp, event);
+#endif
+	return imhttp_res_poll_body(imhttp, event);
+
+    case IMHTTP_RES_TRAILERS: {
+	String_View trailer_line;
+	ImHTTP_Result result = imhttp_res_poll_line(imhttp, &trailer_line);
+	if(result != IMHTTP_OK) return result;
+
+	if(trailer_line.count == 0) {
+	    imhttp->res_state = IMHTTP_RES_DONE;
+	    IMHTTP_STATS_MARK(imhttp, IMHTTP_PHASE_BODY_END);
+	    event->kind = IMHTTP_EVENT_END;
+	    return IMHTTP_OK;
+	}
+
+	event->kind = IMHTTP_EVENT_TRAILER;
+	event->name = sv_chop_by_delim(&trailer_line, ':');
+	sv_trim(&trailer_line);
+	event->value = trailer_line;
+	event->header = imhttp_header_lookup(event->name);
+	return IMHTTP_OK;
+    }
+
+    case IMHTTP_RES_DONE:
+	event->kind = IMHTTP_EVENT_END;
+	return IMHTTP_OK;
+
+    case IMHTTP_RES_ERROR:
+	return IMHTTP_ERROR;
+
+    default:
+	assert(0 && "imhttp_res_poll: unreachable");
+	return IMHTTP_ERROR;
+    }
+}
+
+// * The blocking API is a thin layer over imhttp_res_poll()
+
+static bool imhttp_res_wait(ImHTTP *imhttp, ImHTTP_Event *event) {
+    ImHTTP_Result result = imhttp_res_poll(imhttp, event);
+    assert(result != IMHTTP_AGAIN && "The blocking imhttp_res_* API can't be used on a non-blocking socket, use imhttp_res_poll()");
+    return result == IMHTTP_OK;
+}
+
+// * Get the status code from response
+uint64_t imhttp_res_status_code(ImHTTP *imhttp) {
+    if(imhttp->res_state == IMHTTP_RES_STATUS) {
+	ImHTTP_Event event;
+	imhttp_res_wait(imhttp, &event);
+    }
+    return imhttp->status_code;
+}
+
+bool imhttp_res_next_header(ImHTTP *imhttp, String_View *name, String_View *value) {
+    if(imhttp->res_state == IMHTTP_RES_STATUS) {
+	imhttp_res_status_code(imhttp);
+    }
+    if(imhttp->res_state != IMHTTP_RES_HEADERS) {
+	return false;
+    }
+
+    ImHTTP_Event event;
+    if(!imhttp_res_wait(imhttp, &event) || event.kind != IMHTTP_EVENT_HEADER) {
+	return false;
+    }
+
+    *name = event.name;
+    *value = event.value;
+    return true;
 }
 
 bool imhttp_res_next_body_chunk(ImHTTP *imhttp, String_View *chunk) {
+    // * Skip whatever headers the caller did not bother to read
+    while(imhttp->res_state < IMHTTP_RES_BODY) {
+	String_View name, value;
+	imhttp_res_next_header(imhttp, &name, &value);
+    }
+    if(imhttp->res_state != IMHTTP_RES_BODY) {
+	return false;
+    }
 
-    // * TODO: ImHTTP can't handle the responses that do not set Content-Length    
-    // printf("Content Length: %d\n", imhttp->content_length);
-    assert(imhttp->content_length >= 0);
+    ImHTTP_Event event;
+    if(!imhttp_res_wait(imhttp, &event) || event.kind != IMHTTP_EVENT_BODY_CHUNK) {
+	return false;
+    }
 
-    if(imhttp->content_length > 0) {
-	imhttp_top_rollin_buffer(imhttp);
-	String_View rollin = imhttp_rollin_buffer_as_sv(imhttp);
-	// SV_PRINT(rollin);
-	
-	// * TODO: ImHTTP does not handle the situation when the server responded with more data than it claimed with Content-Length Header	
-	// assert(rollin.count <= (size_t) imhttp->content_length);
+    if(chunk) {
+	*chunk = event.chunk;
+    }
+    return true;
+}
 
-	String_View result = imhttp_shift_rollin_buffer(
-				 imhttp,
-				 imhttp->rollin_buffer + imhttp->rollin_buffer_size);
+static bool imhttp_fd_write_all(int fd, const char *buf, size_t count) {
+    while(count > 0) {
+	ssize_t n = write(fd, buf, count);
+	if(n < 0 && errno == EINTR) continue;
+	if(n <= 0) return false;
+	buf += n;
+	count -= n;
+    }
+    return true;
+}
 
-	if(chunk) {
-	    *chunk = result;
+// * The Content-Length body goes from the socket to `out_fd` in the kernel.
+// * Returns false if the response failed, `transferred` counts what made it.
+static bool imhttp_res_splice_body(ImHTTP *imhttp, int out_fd, int64_t *transferred) {
+    String_View rollin = imhttp_rollin_buffer_as_sv(imhttp);
+    if(rollin.count > (uint64_t) imhttp->content_length) {
+	rollin.count = imhttp->content_length;
+    }
+    if(rollin.count > 0) {
+	if(!imhttp_fd_write_all(out_fd, rollin.data, rollin.count)) {
+	    imhttp_res_fail(imhttp, "Could not write the body");
+	    return false;
 	}
+	imhttp_shift_rollin_buffer(imhttp, rollin.data + rollin.count);
+	imhttp->content_length -= rollin.count;
+	*transferred += rollin.count;
+    }
 
-	imhttp->content_length -= result.count;
-	return true;
+    bool first = true;
+    while(imhttp->content_length > 0) {
+	ssize_t n = imhttp->splice(imhttp->socket, out_fd, imhttp->content_length);
+	if(n < 0 && errno == EINTR) continue;
+	// * `out_fd` can't be spliced into, the caller copies the body instead
+	if(n < 0 && first && errno == EINVAL) return true;
+	if(n == 0) {
+	    imhttp_res_fail(imhttp, "The connection was closed in the middle of the response");
+	    return false;
+	}
+	if(n < 0) {
+	    imhttp_res_fail(imhttp, "Could not splice the body");
+	    return false;
+	}
+	IMHTTP_STATS_ADD(imhttp, reads, 1);
+	IMHTTP_STATS_ADD(imhttp, bytes_read, n);
+	imhttp->content_length -= n;
+	*transferred += n;
+	first = false;
     }
-   
-    return false;
+    return true;
+}
+
+int64_t imhttp_res_body_to_fd(ImHTTP *imhttp, int out_fd) {
+    while(imhttp->res_state < IMHTTP_RES_BODY) {
+	String_View name, value;
+	imhttp_res_next_header(imhttp, &name, &value);
+    }
+    if(imhttp->res_state == IMHTTP_RES_ERROR) return -1;
+
+    int64_t transferred = 0;
+    if(imhttp->res_state == IMHTTP_RES_BODY
+       && imhttp->splice != NULL
+       && !imhttp->decoding
+       && !imhttp->chunked
+       && imhttp->content_length > 0) {
+	if(!imhttp_res_splice_body(imhttp, out_fd, &transferred)) return -1;
+    }
+
+    // * Whatever splicing did not take, down to the BODY_END of a spliced body
+    String_View chunk;
+    while(imhttp_res_next_body_chunk(imhttp, &chunk)) {
+	if(!imhttp_fd_write_all(out_fd, chunk.data, chunk.count)) {
+	    imhttp_res_fail(imhttp, "Could not write the body");
+	    return -1;
+	}
+	transferred += chunk.count;
+    }
+    return imhttp->res_state == IMHTTP_RES_ERROR ? -1 : transferred;
+}
+
+bool imhttp_res_next_trailer(ImHTTP *imhttp, String_View *name, String_View *value) {
+    while(imhttp->res_state < IMHTTP_RES_TRAILERS) {
+	imhttp_res_next_body_chunk(imhttp, NULL);
+    }
+    if(imhttp->res_state != IMHTTP_RES_TRAILERS) {
+	return false;
+    }
+
+    ImHTTP_Event event;
+    if(!imhttp_res_wait(imhttp, &event) || event.kind != IMHTTP_EVENT_TRAILER) {
+	return false;
+    }
+
+    *name = event.name;
+    *value = event.value;
+    return true;
 }
 
 void imhttp_res_end(ImHTTP *imhttp) {
-    (void) imhttp;
+    // * Drain the rest of the response so the next one starts at its status line
+    String_View name, value;
+    while(imhttp->res_state < IMHTTP_RES_DONE) {
+	imhttp_res_next_trailer(imhttp, &name, &value);
+    }
+
+    if(imhttp->requests_in_flight > 0) {
+	imhttp->requests_in_flight -= 1;
+    }
+
+    if(imhttp->config.rollin_pool != NULL && imhttp->rollin_buffer_size == 0) {
+	// * The indexed header block goes back to the pool with the buffer
+	imhttp->rollin_pinned = 0;
+	if(imhttp->header_index != NULL) {
+	    imhttp->header_index->block = NULL;
+	    imhttp->header_index->count = 0;
+	}
+	imhttp_rollin_buffer_release(imhttp);
+    }
+
+#ifdef IMHTTP_STATS
+    imhttp_stats_res_end(imhttp);
+#endif
 }
 
 
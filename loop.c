@@ -0,0 +1,791 @@
+#define _GNU_SOURCE
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include<errno.h>
+#include<assert.h>
+
+#include<sys/types.h>
+#include<sys/socket.h>
+#include<sys/epoll.h>
+#include<poll.h>
+#include<netinet/in.h>
+#include<unistd.h>
+
+#include "./loop.h"
+
+typedef enum {
+    LOOP_CONN_CONNECTING,
+    LOOP_CONN_ACTIVE,
+    LOOP_CONN_IDLE,
+} Loop_Conn_Phase;
+
+// * What an io_uring completion was for, kept in the low bits of user_data
+typedef enum {
+    LOOP_OP_CONNECT = 1,
+    LOOP_OP_SEND,
+    LOOP_OP_RECV,
+} Loop_Op;
+
+#define LOOP_OP_MASK 3
+// * io_uring user_data of the poll on the resolver's event_fd
+#define LOOP_DNS_USER_DATA 0
+#define LOOP_NO_BUFFER UINT32_MAX
+
+struct ImHTTP_Loop_Conn {
+    ImHTTP imhttp;
+    ImHTTP_Loop *loop;
+    int fd;
+    Loop_Conn_Phase phase;
+    uint32_t watched;
+    bool registered;
+    // * A write to the socket failed, the request can't succeed anymore
+    bool broken;
+    size_t address;
+    ImHTTP_Loop_Request *request;
+
+    // * Request bytes the socket did not take yet
+    char *out;
+    size_t out_begin;
+    size_t out_size;
+    size_t out_capacity;
+
+    // * io_uring only. The connection is freed once nothing is in flight anymore.
+    unsigned pending;
+    bool send_pending;
+    bool recv_pending;
+    bool closing;
+    uint32_t buffer;
+    // * IORING_OP_CONNECT reads it when submitted, after the resolver's answer is gone
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    // * The other resolved addresses, tried in order if the connect fails.
+    // * NULL if the host has only one.
+    ImHTTP_Addresses *fallback;
+    size_t fallback_next;
+
+    ImHTTP_Loop_Conn *next_idle;
+};
+
+static_assert(_Alignof(ImHTTP_Loop_Conn) > LOOP_OP_MASK, "Loop_Op must fit into the low bits of a connection pointer");
+
+static ssize_t loop_conn_write(ImHTTP_Socket socket, const void *buf, size_t count) {
+    ImHTTP_Loop_Conn *conn = socket;
+    if(conn->broken) return count;
+
+    size_t written = 0;
+    // * io_uring sends the whole queue once the request is written
+    if(conn->out_size == 0 && conn->loop->backend == IMHTTP_LOOP_EPOLL) {
+	ssize_t n = send(conn->fd, buf, count, MSG_NOSIGNAL);
+	if(n >= 0) {
+	    written = n;
+	} else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+	    conn->broken = true;
+	    return count;
+	}
+    }
+
+    // * Queue the rest, it goes out once the socket is writable again
+    size_t rest = count - written;
+    if(rest > 0) {
+	if(conn->out_begin + conn->out_size + rest > conn->out_capacity) {
+	    memmove(conn->out, conn->out + conn->out_begin, conn->out_size);
+	    conn->out_begin = 0;
+	}
+	if(conn->out_size + rest > conn->out_capacity) {
+	    size_t new_capacity = conn->out_capacity == 0 ? IMHTTP_REQ_BUFFER_CAPACITY : conn->out_capacity;
+	    while(new_capacity < conn->out_size + rest) new_capacity *= 2;
+	    char *new_out = realloc(conn->out, new_capacity);
+	    if(new_out == NULL) {
+		conn->broken = true;
+		return count;
+	    }
+	    conn->out = new_out;
+	    conn->out_capacity = new_capacity;
+	}
+	memcpy(conn->out + conn->out_begin + conn->out_size, (const char *) buf + written, rest);
+	conn->out_size += rest;
+    }
+
+    // * ImHTTP never sees a partial write, the queue takes care of it
+    return count;
+}
+
+static ssize_t loop_conn_read(ImHTTP_Socket socket, void *buf, size_t count) {
+    ImHTTP_Loop_Conn *conn = socket;
+    return read(conn->fd, buf, count);
+}
+
+static bool loop_conn_watch(ImHTTP_Loop_Conn *conn, uint32_t events) {
+    if(conn->registered && conn->watched == events) return true;
+
+    struct epoll_event event = {0};
+    event.events = events;
+    event.data.ptr = conn;
+    int op = conn->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if(epoll_ctl(conn->loop->epoll_fd, op, conn->fd, &event) < 0) return false;
+
+    conn->registered = true;
+    conn->watched = events;
+    return true;
+}
+
+static void loop_conn_give_back_buffer(ImHTTP_Loop_Conn *conn) {
+    ImHTTP_Loop *loop = conn->loop;
+    if(conn->buffer != LOOP_NO_BUFFER) {
+	loop->uring_free_buffers[loop->uring_free_buffers_count++] = conn->buffer;
+	conn->buffer = LOOP_NO_BUFFER;
+    }
+}
+
+static void loop_conn_free(ImHTTP_Loop_Conn *conn) {
+    loop_conn_give_back_buffer(conn);
+    // * Closing the descriptor also removes it from the epoll set
+    close(conn->fd);
+    imhttp_free(&conn->imhttp);
+    free(conn->out);
+    free(conn->fallback);
+    free(conn);
+}
+
+static void loop_conn_close(ImHTTP_Loop_Conn *conn) {
+    if(conn->pending == 0) {
+	loop_conn_free(conn);
+	return;
+    }
+    // * Makes the operations in flight complete, the last one frees the connection
+    conn->closing = true;
+    conn->loop->closing += 1;
+    shutdown(conn->fd, SHUT_RDWR);
+}
+
+static void loop_idle_remove(ImHTTP_Loop *loop, ImHTTP_Loop_Conn *conn) {
+    for(ImHTTP_Loop_Conn **it = &loop->idle; *it != NULL; it = &(*it)->next_idle) {
+	if(*it == conn) {
+	    *it = conn->next_idle;
+	    conn->next_idle = NULL;
+	    loop->idle_count -= 1;
+	    return;
+	}
+    }
+    assert(0 && "loop_idle_remove: the connection is not idle");
+}
+
+static struct io_uring_sqe *loop_uring_prep(ImHTTP_Loop_Conn *conn, Loop_Op op) {
+    struct io_uring_sqe *sqe = imhttp_uring_get_sqe(&conn->loop->uring);
+    if(sqe == NULL) return NULL;
+    sqe->fd = conn->fd;
+    sqe->user_data = (uint64_t) (uintptr_t) conn | op;
+    conn->pending += 1;
+    return sqe;
+}
+
+static bool loop_uring_send(ImHTTP_Loop_Conn *conn) {
+    if(conn->send_pending || conn->out_size == 0) return true;
+    struct io_uring_sqe *sqe = loop_uring_prep(conn, LOOP_OP_SEND);
+    if(sqe == NULL) return false;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->addr = (uint64_t) (uintptr_t) (conn->out + conn->out_begin);
+    sqe->len = conn->out_size;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    conn->send_pending = true;
+    return true;
+}
+
+// * Only ever one receive in flight, the parser must not touch the ring meanwhile
+static bool loop_uring_recv(ImHTTP_Loop_Conn *conn) {
+    if(conn->recv_pending) return true;
+
+    // * A line that did not fit into the registered buffer moved the bytes
+    // * to an allocated one (rollin_buffer_spill), the slot is free again
+    if(conn->buffer != LOOP_NO_BUFFER && (conn->imhttp.rollin_buffer_owned || conn->imhttp.rollin_buffer_pooled)) {
+	loop_conn_give_back_buffer(conn);
+    }
+
+    char *dst = NULL;
+    size_t avail = imhttp_res_feed_reserve(&conn->imhttp, &dst);
+    assert(avail > 0 && "loop_uring_recv: the parser must have failed on a full rollin buffer");
+
+    struct io_uring_sqe *sqe = loop_uring_prep(conn, LOOP_OP_RECV);
+    if(sqe == NULL) return false;
+    if(conn->buffer != LOOP_NO_BUFFER) {
+	sqe->opcode = IORING_OP_READ_FIXED;
+	sqe->buf_index = 0;
+	sqe->off = (uint64_t) -1;
+    } else {
+	sqe->opcode = IORING_OP_RECV;
+    }
+    sqe->addr = (uint64_t) (uintptr_t) dst;
+    sqe->len = avail;
+    conn->recv_pending = true;
+    // * An idle connection keeps it in flight across imhttp_res_begin()
+    conn->imhttp.rollin_receiving = true;
+    return true;
+}
+
+static void loop_conn_finish(ImHTTP_Loop_Conn *conn, ImHTTP_Result result, const char *error) {
+    ImHTTP_Loop *loop = conn->loop;
+    ImHTTP_Loop_Request *request = conn->request;
+
+    request->status_code = conn->imhttp.status_code;
+    request->error = error;
+    conn->request = NULL;
+    loop->active -= 1;
+
+    // * Recycle the connection before on_done() so it can be reused right away
+    size_t max_idle = loop->max_idle > 0 ? loop->max_idle : IMHTTP_LOOP_DEFAULT_MAX_IDLE;
+    bool reusable = result == IMHTTP_OK
+	&& conn->imhttp.keep_alive
+	&& !conn->broken
+	&& conn->out_size == 0
+	&& !conn->send_pending
+	&& conn->imhttp.rollin_buffer_size == 0
+	&& loop->idle_count < max_idle;
+
+    if(reusable) {
+	// * Idle connections keep a receive around to notice the server closing them
+	if(loop->backend == IMHTTP_LOOP_URING) {
+	    reusable = loop_uring_recv(conn);
+	} else {
+	    reusable = loop_conn_watch(conn, EPOLLIN | EPOLLRDHUP);
+	}
+    }
+
+    if(reusable) {
+	conn->phase = LOOP_CONN_IDLE;
+	conn->imhttp.requests_in_flight = 0;
+	conn->next_idle = loop->idle;
+	loop->idle = conn;
+	loop->idle_count += 1;
+    } else {
+	loop_conn_close(conn);
+    }
+
+    if(request->on_done) {
+	request->on_done(request, result);
+    }
+}
+
+// * Feeds everything the socket has to the parser
+static void loop_conn_drive_response(ImHTTP_Loop_Conn *conn) {
+    for(;;) {
+	ImHTTP_Event event;
+	ImHTTP_Result result = imhttp_res_poll(&conn->imhttp, &event);
+	if(result == IMHTTP_AGAIN) {
+	    if(conn->loop->backend == IMHTTP_LOOP_URING && !loop_uring_recv(conn)) {
+		loop_conn_finish(conn, IMHTTP_ERROR, "Could not receive the response");
+	    }
+	    return;
+	}
+	if(result == IMHTTP_ERROR) {
+	    loop_conn_finish(conn, IMHTTP_ERROR, conn->imhttp.res_error);
+	    return;
+	}
+
+	if(conn->request->on_event) {
+	    conn->request->on_event(conn->request, &event);
+	}
+
+	if(event.kind == IMHTTP_EVENT_END) {
+	    imhttp_res_end(&conn->imhttp);
+	    loop_conn_finish(conn, IMHTTP_OK, NULL);
+	    return;
+	}
+    }
+}
+
+static void loop_conn_flush(ImHTTP_Loop_Conn *conn) {
+    while(conn->out_size > 0) {
+	ssize_t n = send(conn->fd, conn->out + conn->out_begin, conn->out_size, MSG_NOSIGNAL);
+	if(n < 0) {
+	    if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+	    if(errno == EINTR) continue;
+	    conn->broken = true;
+	    return;
+	}
+	conn->out_begin += n;
+	conn->out_size -= n;
+    }
+    if(conn->out_size == 0) conn->out_begin = 0;
+}
+
+static void loop_conn_start_request(ImHTTP_Loop_Conn *conn) {
+    conn->phase = LOOP_CONN_ACTIVE;
+    conn->request->write_request(conn->request, &conn->imhttp);
+    if(conn->broken) {
+	loop_conn_finish(conn, IMHTTP_ERROR, "Could not send the request");
+	return;
+    }
+
+    imhttp_res_begin(&conn->imhttp);
+    if(conn->loop->backend == IMHTTP_LOOP_URING) {
+	// * An idle connection already has its receive in flight
+	if(!loop_uring_send(conn) || !loop_uring_recv(conn)) {
+	    loop_conn_finish(conn, IMHTTP_ERROR, "Could not submit the request");
+	}
+	return;
+    }
+
+    if(!loop_conn_watch(conn, EPOLLIN | (conn->out_size > 0 ? EPOLLOUT : 0))) {
+	loop_conn_finish(conn, IMHTTP_ERROR, "Could not watch the socket");
+    }
+}
+
+// * Starts connecting `conn` to `addr` on a new socket
+static bool loop_conn_connect(ImHTTP_Loop_Conn *conn, const ImHTTP_Address *addr) {
+    const bool uring = conn->loop->backend == IMHTTP_LOOP_URING;
+    // * io_uring waits for readiness by itself, a non-blocking socket would only get EAGAIN
+    conn->fd = socket(addr->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC | (uring ? 0 : SOCK_NONBLOCK), IPPROTO_TCP);
+    conn->registered = false;
+    if(conn->fd < 0) return false;
+    conn->phase = LOOP_CONN_CONNECTING;
+
+    if(uring) {
+	memcpy(&conn->addr, &addr->addr, addr->addr_len);
+	conn->addr_len = addr->addr_len;
+	struct io_uring_sqe *sqe = loop_uring_prep(conn, LOOP_OP_CONNECT);
+	if(sqe == NULL) return false;
+	sqe->opcode = IORING_OP_CONNECT;
+	sqe->addr = (uint64_t) (uintptr_t) &conn->addr;
+	sqe->off = conn->addr_len;
+	return true;
+    }
+
+    if(connect(conn->fd, (const struct sockaddr *) &addr->addr, addr->addr_len) == 0) {
+	loop_conn_start_request(conn);
+	return true;
+    }
+    return errno == EINPROGRESS && loop_conn_watch(conn, EPOLLOUT);
+}
+
+// * After a failed connect. Returns false once every address was tried.
+static bool loop_conn_connect_next(ImHTTP_Loop_Conn *conn) {
+    while(conn->fallback != NULL && conn->fallback_next < conn->fallback->count) {
+	close(conn->fd);
+	if(loop_conn_connect(conn, &conn->fallback->items[conn->fallback_next++])) return true;
+    }
+    return false;
+}
+
+static void loop_conn_handle(ImHTTP_Loop_Conn *conn, uint32_t events) {
+    switch(conn->phase) {
+    case LOOP_CONN_CONNECTING: {
+	int error = 0;
+	socklen_t error_len = sizeof(error);
+	if(getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 || error != 0) {
+	    if(!loop_conn_connect_next(conn)) loop_conn_finish(conn, IMHTTP_ERROR, "Could not connect");
+	    return;
+	}
+	loop_conn_start_request(conn);
+    } break;
+
+    case LOOP_CONN_ACTIVE: {
+	if(events & EPOLLOUT) {
+	    loop_conn_flush(conn);
+	    if(conn->broken) {
+		loop_conn_finish(conn, IMHTTP_ERROR, "Could not send the request");
+		return;
+	    }
+	    if(!loop_conn_watch(conn, EPOLLIN | (conn->out_size > 0 ? EPOLLOUT : 0))) {
+		loop_conn_finish(conn, IMHTTP_ERROR, "Could not watch the socket");
+		return;
+	    }
+	}
+	if(events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+	    loop_conn_drive_response(conn);
+	}
+    } break;
+
+    case LOOP_CONN_IDLE:
+	// * Nothing is expected on an idle connection, the server closed it
+	loop_idle_remove(conn->loop, conn);
+	loop_conn_close(conn);
+	break;
+
+    default:
+	assert(0 && "loop_conn_handle: unreachable");
+    }
+}
+
+static void loop_conn_complete(ImHTTP_Loop_Conn *conn, Loop_Op op, int res) {
+    assert(conn->pending > 0);
+    conn->pending -= 1;
+    if(op == LOOP_OP_SEND) conn->send_pending = false;
+    if(op == LOOP_OP_RECV) {
+	conn->recv_pending = false;
+	conn->imhttp.rollin_receiving = false;
+    }
+
+    if(conn->closing) {
+	if(conn->pending == 0) {
+	    conn->loop->closing -= 1;
+	    loop_conn_free(conn);
+	}
+	return;
+    }
+
+    switch(op) {
+    case LOOP_OP_CONNECT:
+	if(res < 0) {
+	    if(!loop_conn_connect_next(conn)) loop_conn_finish(conn, IMHTTP_ERROR, "Could not connect");
+	    return;
+	}
+	loop_conn_start_request(conn);
+	break;
+
+    case LOOP_OP_SEND:
+	if(res < 0) {
+	    conn->broken = true;
+	    if(conn->phase == LOOP_CONN_ACTIVE) {
+		loop_conn_finish(conn, IMHTTP_ERROR, "Could not send the request");
+	    }
+	    return;
+	}
+	conn->out_begin += res;
+	conn->out_size -= res;
+	if(conn->out_size == 0) {
+	    conn->out_begin = 0;
+	} else if(!loop_uring_send(conn)) {
+	    loop_conn_finish(conn, IMHTTP_ERROR, "Could not send the request");
+	}
+	break;
+
+    case LOOP_OP_RECV:
+	if(conn->phase == LOOP_CONN_IDLE) {
+	    loop_idle_remove(conn->loop, conn);
+	    loop_conn_close(conn);
+	    return;
+	}
+	if(res > 0) {
+	    imhttp_res_feed_commit(&conn->imhttp, res);
+	} else if(res == 0) {
+	    imhttp_res_feed_eof(&conn->imhttp);
+	} else if(res != -EINTR && res != -EAGAIN) {
+	    loop_conn_finish(conn, IMHTTP_ERROR, "Could not receive the response");
+	    return;
+	}
+	loop_conn_drive_response(conn);
+	break;
+
+    default:
+	assert(0 && "loop_conn_complete: unreachable");
+    }
+}
+
+static bool loop_address(ImHTTP_Loop *loop, const char *host, const char *port, size_t *index) {
+    for(size_t i = 0; i < loop->addresses_count; ++i) {
+	if(strcmp(loop->addresses[i].host, host) == 0 && strcmp(loop->addresses[i].port, port) == 0) {
+	    *index = i;
+	    return true;
+	}
+    }
+
+    if(strlen(host) >= sizeof(loop->addresses[0].host) || strlen(port) >= sizeof(loop->addresses[0].port)) {
+	return false;
+    }
+
+    if(loop->addresses_count >= loop->addresses_capacity) {
+	size_t new_capacity = loop->addresses_capacity == 0 ? 16 : loop->addresses_capacity * 2;
+	ImHTTP_Loop_Address *new_addresses = realloc(loop->addresses, new_capacity * sizeof(*new_addresses));
+	if(new_addresses == NULL) return false;
+	loop->addresses = new_addresses;
+	loop->addresses_capacity = new_capacity;
+    }
+
+    ImHTTP_Loop_Address *address = &loop->addresses[loop->addresses_count];
+    strcpy(address->host, host);
+    strcpy(address->port, port);
+    *index = loop->addresses_count++;
+    return true;
+}
+
+// * A request whose host name is being resolved
+typedef struct {
+    ImHTTP_Loop *loop;
+    ImHTTP_Loop_Request *request;
+    size_t address;
+} Loop_Resolving;
+
+static bool loop_uring_watch_dns(ImHTTP_Loop *loop) {
+    struct io_uring_sqe *sqe = imhttp_uring_get_sqe(&loop->uring);
+    if(sqe == NULL) return false;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = loop->dns.event_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = LOOP_DNS_USER_DATA;
+    return true;
+}
+
+static bool loop_uring_init(ImHTTP_Loop *loop) {
+    if(!imhttp_uring_init(&loop->uring, IMHTTP_LOOP_URING_ENTRIES)) return false;
+
+    // * Fixed buffers are an optimization, connections do fine without them
+    const size_t arena_size = (size_t) IMHTTP_LOOP_URING_BUFFERS * IMHTTP_ROLLIN_BUFFER_CAPACITY;
+    loop->uring_buffers = malloc(arena_size);
+    loop->uring_free_buffers = malloc(IMHTTP_LOOP_URING_BUFFERS * sizeof(*loop->uring_free_buffers));
+    struct iovec arena = { .iov_base = loop->uring_buffers, .iov_len = arena_size };
+    if(loop->uring_buffers == NULL
+       || loop->uring_free_buffers == NULL
+       || !imhttp_uring_register_buffers(&loop->uring, &arena, 1)) {
+	free(loop->uring_buffers);
+	free(loop->uring_free_buffers);
+	loop->uring_buffers = NULL;
+	loop->uring_free_buffers = NULL;
+	return true;
+    }
+
+    // * Handed out lowest first
+    for(unsigned i = 0; i < IMHTTP_LOOP_URING_BUFFERS; ++i) {
+	loop->uring_free_buffers[i] = IMHTTP_LOOP_URING_BUFFERS - 1 - i;
+    }
+    loop->uring_free_buffers_count = IMHTTP_LOOP_URING_BUFFERS;
+    return true;
+}
+
+bool imhttp_loop_init(ImHTTP_Loop *loop, ImHTTP_Loop_Backend backend) {
+    memset(loop, 0, sizeof(*loop));
+    loop->epoll_fd = -1;
+    loop->uring.fd = -1;
+    if(!imhttp_dns_init(&loop->dns, 0)) return false;
+
+    if(backend != IMHTTP_LOOP_EPOLL && loop_uring_init(loop)) {
+	loop->backend = IMHTTP_LOOP_URING;
+	if(loop_uring_watch_dns(loop)) return true;
+	imhttp_uring_free(&loop->uring);
+	free(loop->uring_buffers);
+	free(loop->uring_free_buffers);
+	imhttp_dns_free(&loop->dns);
+	return false;
+    }
+    if(backend == IMHTTP_LOOP_URING) {
+	imhttp_dns_free(&loop->dns);
+	return false;
+    }
+
+    loop->backend = IMHTTP_LOOP_EPOLL;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    // * The only registration without a connection behind it
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if(loop->epoll_fd < 0 || epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->dns.event_fd, &event) < 0) {
+	if(loop->epoll_fd >= 0) close(loop->epoll_fd);
+	imhttp_dns_free(&loop->dns);
+	return false;
+    }
+    return true;
+}
+
+const char *imhttp_loop_backend_name(ImHTTP_Loop_Backend backend) {
+    switch(backend) {
+    case IMHTTP_LOOP_AUTO:  return "auto";
+    case IMHTTP_LOOP_EPOLL: return "epoll";
+    case IMHTTP_LOOP_URING: return "io_uring";
+    default:
+	assert(0 && "imhttp_loop_backend_name: unreachable");
+	return NULL;
+    }
+}
+
+static bool loop_conn_open(ImHTTP_Loop *loop, ImHTTP_Loop_Request *request, size_t address,
+			   const ImHTTP_Addresses *addresses) {
+    ImHTTP_Loop_Conn *conn = calloc(1, sizeof(*conn));
+    if(conn == NULL) return false;
+    conn->loop = loop;
+    conn->fd = -1;
+    conn->address = address;
+    conn->request = request;
+    conn->buffer = LOOP_NO_BUFFER;
+    conn->imhttp.socket = conn;
+    conn->imhttp.write = loop_conn_write;
+    conn->imhttp.read = loop_conn_read;
+    conn->imhttp.config.rollin_pool = loop->rollin_pool;
+
+    if(addresses->count > 1) {
+	conn->fallback = malloc(sizeof(*conn->fallback));
+	if(conn->fallback == NULL) {
+	    loop_conn_free(conn);
+	    return false;
+	}
+	*conn->fallback = *addresses;
+	conn->fallback_next = 1;
+    }
+
+    if(loop->backend == IMHTTP_LOOP_URING) {
+	// * Push mode, loop_uring_recv() receives straight into the rollin buffer
+	conn->imhttp.read = NULL;
+	if(loop->uring_free_buffers_count > 0) {
+	    conn->buffer = loop->uring_free_buffers[--loop->uring_free_buffers_count];
+	    imhttp_set_rollin_buffer(&conn->imhttp,
+				     loop->uring_buffers + (size_t) conn->buffer * IMHTTP_ROLLIN_BUFFER_CAPACITY,
+				     IMHTTP_ROLLIN_BUFFER_CAPACITY, false);
+	    conn->imhttp.rollin_buffer_spill = true;
+	}
+    }
+
+    loop->active += 1;
+    if(!loop_conn_connect(conn, &addresses->items[0]) && !loop_conn_connect_next(conn)) {
+	loop->active -= 1;
+	loop_conn_free(conn);
+	return false;
+    }
+    return true;
+}
+
+// * Reuses an idle keep-alive connection to the same host:port if there is any
+static bool loop_conn_reuse(ImHTTP_Loop *loop, ImHTTP_Loop_Request *request, size_t address) {
+    for(ImHTTP_Loop_Conn *conn = loop->idle; conn != NULL; conn = conn->next_idle) {
+	if(conn->address == address) {
+	    loop_idle_remove(loop, conn);
+	    conn->request = request;
+	    loop->active += 1;
+	    loop_conn_start_request(conn);
+	    return true;
+	}
+    }
+    return false;
+}
+
+static void loop_resolved(void *user_data, const ImHTTP_Addresses *addresses) {
+    Loop_Resolving *resolving = user_data;
+    ImHTTP_Loop *loop = resolving->loop;
+    ImHTTP_Loop_Request *request = resolving->request;
+    const size_t address = resolving->address;
+    free(resolving);
+    loop->active -= 1;
+
+    const char *error = NULL;
+    if(addresses == NULL) {
+	error = "Could not resolve the host";
+    } else if(!loop_conn_reuse(loop, request, address)
+	      && !loop_conn_open(loop, request, address, addresses)) {
+	error = "Could not connect";
+    }
+
+    if(error != NULL) {
+	request->error = error;
+	if(request->on_done) request->on_done(request, IMHTTP_ERROR);
+    }
+}
+
+bool imhttp_loop_submit(ImHTTP_Loop *loop, ImHTTP_Loop_Request *request) {
+    assert(request->write_request != NULL);
+    request->status_code = 0;
+    request->error = NULL;
+
+    size_t address = 0;
+    if(!loop_address(loop, request->host, request->port, &address)) return false;
+    if(loop_conn_reuse(loop, request, address)) return true;
+
+    Loop_Resolving *resolving = malloc(sizeof(*resolving));
+    if(resolving == NULL) return false;
+    resolving->loop = loop;
+    resolving->request = request;
+    resolving->address = address;
+
+    ImHTTP_Addresses addresses;
+    switch(imhttp_dns_resolve(&loop->dns, request->host, request->port, &addresses, loop_resolved, resolving)) {
+    case IMHTTP_DNS_DONE:
+	free(resolving);
+	return loop_conn_open(loop, request, address, &addresses);
+
+    case IMHTTP_DNS_PENDING:
+	// * Counts as active so imhttp_loop_run() waits for it
+	loop->active += 1;
+	return true;
+
+    case IMHTTP_DNS_FAILED:
+	free(resolving);
+	return false;
+
+    default:
+	assert(0 && "imhttp_loop_submit: unreachable");
+	return false;
+    }
+}
+
+#define LOOP_EVENTS_CAPACITY 256
+// * How long an iteration waits at most while the resolver is not watched
+#define LOOP_DNS_POLL_MS 10
+
+static void loop_uring_run_once(ImHTTP_Loop *loop, int timeout_ms) {
+    if(loop->dns_watch_pending) {
+	if(loop_uring_watch_dns(loop)) {
+	    // * Completes right away if a lookup finished meanwhile
+	    loop->dns_watch_pending = false;
+	} else {
+	    imhttp_dns_dispatch(&loop->dns);
+	    if(timeout_ms < 0 || timeout_ms > LOOP_DNS_POLL_MS) timeout_ms = LOOP_DNS_POLL_MS;
+	}
+    }
+
+    imhttp_uring_wait(&loop->uring, timeout_ms);
+
+    struct io_uring_cqe *cqe;
+    while(imhttp_uring_peek_cqe(&loop->uring, &cqe)) {
+	uint64_t user_data = cqe->user_data;
+	int res = cqe->res;
+	imhttp_uring_cqe_seen(&loop->uring);
+
+	if(user_data == LOOP_DNS_USER_DATA) {
+	    imhttp_dns_dispatch(&loop->dns);
+	    // * POLL_ADD is one-shot. imhttp_uring_get_sqe() already submits a
+	    // * full queue, so failing here means io_uring_enter() failed.
+	    loop->dns_watch_pending = !loop_uring_watch_dns(loop);
+	    continue;
+	}
+
+	ImHTTP_Loop_Conn *conn = (ImHTTP_Loop_Conn *) (uintptr_t) (user_data & ~(uint64_t) LOOP_OP_MASK);
+	loop_conn_complete(conn, (Loop_Op) (user_data & LOOP_OP_MASK), res);
+    }
+}
+
+size_t imhttp_loop_run_once(ImHTTP_Loop *loop, int timeout_ms) {
+    if(loop->backend == IMHTTP_LOOP_URING) {
+	loop_uring_run_once(loop, timeout_ms);
+	return loop->active;
+    }
+
+    struct epoll_event events[LOOP_EVENTS_CAPACITY];
+    int n = epoll_wait(loop->epoll_fd, events, LOOP_EVENTS_CAPACITY, timeout_ms);
+    for(int i = 0; i < n; ++i) {
+	if(events[i].data.ptr == NULL) {
+	    imhttp_dns_dispatch(&loop->dns);
+	    continue;
+	}
+	loop_conn_handle(events[i].data.ptr, events[i].events);
+    }
+    return loop->active;
+}
+
+void imhttp_loop_run(ImHTTP_Loop *loop) {
+    while(loop->active > 0) {
+	imhttp_loop_run_once(loop, -1);
+    }
+}
+
+void imhttp_loop_free(ImHTTP_Loop *loop) {
+    assert(loop->active == 0 && "imhttp_loop_free: there are still requests in progress");
+    while(loop->idle != NULL) {
+	ImHTTP_Loop_Conn *conn = loop->idle;
+	loop_idle_remove(loop, conn);
+	loop_conn_close(conn);
+    }
+
+    if(loop->backend == IMHTTP_LOOP_URING) {
+	// * The kernel may still write into the buffers until everything completed
+	while(loop->closing > 0) {
+	    loop_uring_run_once(loop, -1);
+	}
+	imhttp_uring_free(&loop->uring);
+	free(loop->uring_buffers);
+	free(loop->uring_free_buffers);
+    } else {
+	close(loop->epoll_fd);
+    }
+    imhttp_dns_free(&loop->dns);
+    free(loop->addresses);
+    memset(loop, 0, sizeof(*loop));
+}
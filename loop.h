@@ -0,0 +1,126 @@
+#ifndef LOOP_H_
+#define LOOP_H_
+
+#include<stdbool.h>
+#include<stddef.h>
+#include<stdint.h>
+#include<sys/socket.h>
+
+#include "./imhttp.h"
+#include "./uring.h"
+#include "./dns.h"
+
+// * epoll driven event loop that runs many ImHTTP clients on one thread.
+// *
+// * Every submitted request gets a non-blocking connection (an idle
+// * keep-alive one to the same host:port if there is any). Once connected,
+// * write_request() serializes the request with the regular imhttp_req_*
+// * calls. Whatever the socket does not take right away is queued and sent
+// * when it becomes writable. The response is then driven with
+// * imhttp_res_poll() every time the socket becomes readable. Each event is
+// * reported to on_event() and the request finishes with on_done().
+// *
+// * With the io_uring backend, the connects, sends and receives of all the
+// * connections are batched into one io_uring_enter() per iteration.
+// * Responses are received in push mode (imhttp_res_feed_reserve()) straight
+// * into rollin buffers carved out of one registered arena (READ_FIXED).
+// * Connections beyond the arena get a plain RECV into their own storage.
+// * Arena buffers never grow: a status or header line that does not fit
+// * moves the unconsumed bytes to an allocated rollin buffer (which grows up
+// * to rollin_max_capacity like on the other paths), the arena slot is
+// * given back and the connection goes on with plain RECV.
+// *
+// * Host names go through `dns`, whose workers report back through a
+// * descriptor the loop watches like any other, so a request waiting for
+// * its name does not hold up the others.
+
+typedef struct ImHTTP_Loop_Request ImHTTP_Loop_Request;
+
+struct ImHTTP_Loop_Request {
+    const char *host;
+    const char *port;
+
+    // * Required. Must write exactly one complete request, from
+    // * imhttp_req_begin() to imhttp_req_end().
+    void (*write_request)(ImHTTP_Loop_Request *request, ImHTTP *imhttp);
+    // * Optional. The views in `event` are valid only during the call.
+    void (*on_event)(ImHTTP_Loop_Request *request, const ImHTTP_Event *event);
+    // * Optional. `result` is IMHTTP_OK or IMHTTP_ERROR (see `error`).
+    // * The loop does not touch the request after this call.
+    void (*on_done)(ImHTTP_Loop_Request *request, ImHTTP_Result result);
+    void *user_data;
+
+    // * Filled by the loop
+    uint64_t status_code;
+    const char *error;
+};
+
+typedef struct ImHTTP_Loop_Conn ImHTTP_Loop_Conn;
+
+// * Identifies a host:port so idle connections can be matched by index
+typedef struct {
+    char host[IMHTTP_DNS_HOST_CAPACITY];
+    char port[IMHTTP_DNS_PORT_CAPACITY];
+} ImHTTP_Loop_Address;
+
+typedef enum {
+    // * io_uring if the kernel allows it, epoll otherwise
+    IMHTTP_LOOP_AUTO,
+    IMHTTP_LOOP_EPOLL,
+    IMHTTP_LOOP_URING,
+} ImHTTP_Loop_Backend;
+
+typedef struct {
+    // * The backend actually in use
+    ImHTTP_Loop_Backend backend;
+    int epoll_fd;
+    ImHTTP_Uring uring;
+    // * Registered rollin buffers, IMHTTP_LOOP_URING_BUFFERS of them at most
+    char *uring_buffers;
+    unsigned *uring_free_buffers;
+    size_t uring_free_buffers_count;
+    // * Closed connections still waiting for their io_uring operations
+    size_t closing;
+    // * The poll on the resolver's event_fd could not be submitted again.
+    // * Retried on every iteration, the resolver is polled meanwhile.
+    bool dns_watch_pending;
+
+    // * Requests submitted and not finished yet
+    size_t active;
+
+    // * Keep-alive connections waiting for the next request
+    ImHTTP_Loop_Conn *idle;
+    size_t idle_count;
+    // * Idle connections kept at most. 0 means the default.
+    size_t max_idle;
+    // * Optional. Connections without a registered io_uring buffer borrow
+    // * their rollin buffer from here while they have bytes to parse.
+    ImHTTP_Buffer_Pool *rollin_pool;
+
+    // * Initialized by imhttp_loop_init(). Static names, `offline` and the
+    // * TTLs may be set up before the first submit.
+    ImHTTP_Dns dns;
+
+    ImHTTP_Loop_Address *addresses;
+    size_t addresses_count;
+    size_t addresses_capacity;
+} ImHTTP_Loop;
+
+#define IMHTTP_LOOP_DEFAULT_MAX_IDLE 1024
+#define IMHTTP_LOOP_URING_ENTRIES 4096
+#define IMHTTP_LOOP_URING_BUFFERS 1024
+
+// * Fails if the requested backend is not available. IMHTTP_LOOP_AUTO only
+// * fails if neither is.
+bool imhttp_loop_init(ImHTTP_Loop *loop, ImHTTP_Loop_Backend backend);
+const char *imhttp_loop_backend_name(ImHTTP_Loop_Backend backend);
+// * Returns false if the request could not even be started, on_done() is not called then
+bool imhttp_loop_submit(ImHTTP_Loop *loop, ImHTTP_Loop_Request *request);
+// * Waits up to `timeout_ms` (-1 forever) and handles whatever became ready.
+// * Returns the number of requests still active.
+size_t imhttp_loop_run_once(ImHTTP_Loop *loop, int timeout_ms);
+// * Runs until every submitted request is done
+void imhttp_loop_run(ImHTTP_Loop *loop);
+void imhttp_loop_free(ImHTTP_Loop *loop);
+
+#endif // * LOOP_H_
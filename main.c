@@ -8,110 +8,77 @@
 #include<stdbool.h>
 #include <inttypes.h>
 
-#include<netdb.h>
 #include<sys/types.h>
-#include<sys/socket.h>
-#include<netinet/in.h>
-#include<arpa/inet.h>
-#include<unistd.h>
 #include<assert.h>
 
+#include "./pool.h"
+
 #define IMHTTP_IMPLEMENTATION
 #include "./imhttp.h"
 
 #define HOST "google.com"
 #define PORT "80"
 
-ssize_t imhttp_write(ImHTTP_Socket socket, const void *buf, size_t count) {
-    // * Write Linux System Call
-    return write((int) (int64_t)socket, buf, count);
-}
-
-ssize_t imhttp_read(ImHTTP_Socket socket, void *buf, size_t count) {
-    // * Read Linux System Call
-    // printf("Descriptor: %p\n", socket);
-    // printf("Buffer: %p\n", buf);
-    // printf("Count: %ld\n", count);
-    return read((int) (int64_t)socket, buf, count);
-}
-
-
 int main() {
-    // * Resolve the host (DNS Resolution)
-    struct addrinfo hints = {0};
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
-
-    struct addrinfo *addrs; // * Linked List
-    if(getaddrinfo(HOST, PORT, &hints, &addrs) < 0) {
-	fprintf(stderr, "Could not get address of `"HOST"`:%s\n", strerror(errno));
+    // * Both requests go over the same keep-alive connection
+    static ImHTTP_Pool pool = {0};
+    // * Resolves HOST once for the whole run
+    static ImHTTP_Dns dns = {0};
+    if(!imhttp_dns_init(&dns, 1)) {
+	fprintf(stderr, "Could not start the resolver: %s\n", strerror(errno));
 	exit(1);
     }
+    pool.dns = &dns;
 
-    // Loop over all resolved IPv4 addresses
-    int sd = 0;
-    for(struct addrinfo *addr = addrs; addr != NULL; addr = addr->ai_next) {
-	sd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
-
-	if(sd == -1) break;
-	if(connect(sd, addr->ai_addr, addr->ai_addrlen) == 0) break;
-
-	close(sd);
-	sd = -1;
-    }
-    freeaddrinfo(addrs);
-
-    if (sd == -1) {
-	fprintf(stderr, "Could not connect to " HOST ":" PORT ": %s\n", strerror(errno));	
-	exit(1);	
-    }
-
-    // * imhttp socket object
-    static ImHTTP imhttp = {
-		    .write = imhttp_write,
-		    .read = imhttp_read,
-    };
-    imhttp.socket = (void*) (int64_t) sd;
-
-    imhttp_req_begin(&imhttp, IMHTTP_GET, "/");
-    // printf("Socket: %d\n", sd);
-    // * Add some headers to request headers
-    {
-	imhttp_req_header(&imhttp, "Host", HOST);
-	imhttp_req_header(&imhttp, "Foo", "Bar");
-	imhttp_req_header(&imhttp, "Hello", "World");
-	imhttp_req_headers_end(&imhttp);
-	imhttp_req_body_chunk(&imhttp, "Hello World\n");
-	imhttp_req_body_chunk(&imhttp, "Test, test, test\n");
-    }
-    imhttp_req_end(&imhttp);
-
-    imhttp_res_begin(&imhttp);
-    {
-	uint64_t status_code = imhttp_res_status_code(&imhttp);
-	printf("Status Code: %"PRIu64"\n", status_code);
+    for(int i = 0; i < 2; ++i) {
+	ImHTTP *imhttp = imhttp_pool_acquire(&pool, HOST, PORT);
+	if(imhttp == NULL) {
+	    fprintf(stderr, "Could not connect to " HOST ":" PORT ": %s\n", strerror(errno));
+	    exit(1);
+	}
 
-	// * Read headers
-	String_View name, value;
-	while(imhttp_res_next_header(&imhttp, &name, &value)) {
-	    printf("-----------------------------------------\n");	    
-	    printf("Header Name: "SV_Fmt"\n", SV_Arg(name));
-	    printf("Header Value: "SV_Fmt"\n", SV_Arg(value));
+	imhttp_req_begin(imhttp, IMHTTP_GET, "/");
+	// * Add some headers to request headers
+	{
+	    imhttp_req_header(imhttp, "Host", HOST);
+	    imhttp_req_header(imhttp, "Foo", "Bar");
+	    imhttp_req_header(imhttp, "Hello", "World");
+	    imhttp_req_headers_end(imhttp);
 	}
-	printf("-----------------------------------------\n");
+	if(!imhttp_req_end(imhttp)) {
+	    fprintf(stderr, "Could not send the request: %s\n", strerror(errno));
+	    exit(1);
+	}
+
+	imhttp_res_begin(imhttp);
+	{
+	    uint64_t status_code = imhttp_res_status_code(imhttp);
+	    printf("Status Code: %"PRIu64"\n", status_code);
+
+	    // * Read headers
+	    String_View name, value;
+	    while(imhttp_res_next_header(imhttp, &name, &value)) {
+		printf("-----------------------------------------\n");	    
+		printf("Header Name: "SV_Fmt"\n", SV_Arg(name));
+		printf("Header Value: "SV_Fmt"\n", SV_Arg(value));
+	    }
+	    printf("-----------------------------------------\n");
+
+	    // * Read body chunks
+	    String_View chunk;
+	    while(imhttp_res_next_body_chunk(imhttp, &chunk)) {
+		printf(SV_Fmt, SV_Arg(chunk));
+	    }
 
-	// * Read body chunks
-	String_View chunk;
-	while(imhttp_res_next_body_chunk(&imhttp, &chunk)) {
-	    printf(SV_Fmt, SV_Arg(chunk));
 	}
+	imhttp_res_end(imhttp);
 
+	// * Goes back to the pool unless the server asked to close it
+	imhttp_pool_release(&pool, imhttp);
     }
-    imhttp_res_end(&imhttp);
 
-    
-    close(sd);
+    imhttp_pool_free(&pool);
+    imhttp_dns_free(&dns);
 
     return 0;
 }
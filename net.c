@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stddef.h>
+#include<string.h>
+#include<errno.h>
+#include<stdbool.h>
+#include<assert.h>
+
+#include<netdb.h>
+#include<sys/types.h>
+#include<sys/socket.h>
+#include<sys/uio.h>
+#include<sys/sendfile.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<poll.h>
+#include<time.h>
+
+#include "./net.h"
+
+static_assert(sizeof(ImHTTP_Iovec) == sizeof(struct iovec), "ImHTTP_Iovec must match struct iovec");
+static_assert(offsetof(ImHTTP_Iovec, base) == offsetof(struct iovec, iov_base), "ImHTTP_Iovec must match struct iovec");
+static_assert(offsetof(ImHTTP_Iovec, len) == offsetof(struct iovec, iov_len), "ImHTTP_Iovec must match struct iovec");
+
+// * MSG_NOSIGNAL: a connection the server closed fails with EPIPE instead of
+// * raising SIGPIPE, which would kill the process by default
+ssize_t imhttp_net_write(ImHTTP_Socket socket, const void *buf, size_t count) {
+    return send((int) (int64_t)socket, buf, count, MSG_NOSIGNAL);
+}
+
+ssize_t imhttp_net_read(ImHTTP_Socket socket, void *buf, size_t count) {
+    // * Read Linux System Call
+    return read((int) (int64_t)socket, buf, count);
+}
+
+ssize_t imhttp_net_writev(ImHTTP_Socket socket, const ImHTTP_Iovec *iov, int iovcnt) {
+    // * writev() with MSG_NOSIGNAL
+    struct msghdr msg = {0};
+    msg.msg_iov = (struct iovec *) iov;
+    msg.msg_iovlen = iovcnt;
+    return sendmsg((int) (int64_t)socket, &msg, MSG_NOSIGNAL);
+}
+
+ssize_t imhttp_net_sendfile(ImHTTP_Socket socket, int in_fd, int64_t *offset, size_t count) {
+    // * Sendfile Linux System Call, the page cache goes straight to the socket
+    off_t position = (off_t) *offset;
+    ssize_t n = sendfile((int) (int64_t)socket, in_fd, &position, count);
+    *offset = (int64_t) position;
+    return n;
+}
+
+bool imhttp_net_resolve(const char *host, const char *port, ImHTTP_Addresses *addresses) {
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = AI_ADDRCONFIG;
+
+    struct addrinfo *addrs; // * Linked List
+    if(getaddrinfo(host, port, &hints, &addrs) != 0) {
+	return false;
+    }
+
+    addresses->count = 0;
+    for(struct addrinfo *addr = addrs; addr != NULL && addresses->count < IMHTTP_NET_MAX_ADDRESSES; addr = addr->ai_next) {
+	ImHTTP_Address *address = &addresses->items[addresses->count++];
+	memcpy(&address->addr, addr->ai_addr, addr->ai_addrlen);
+	address->addr_len = addr->ai_addrlen;
+    }
+    freeaddrinfo(addrs);
+    return addresses->count > 0;
+}
+
+ssize_t imhttp_net_splice(ImHTTP_Socket socket, int out_fd, size_t count) {
+    const int sd = (int) (int64_t)socket;
+
+    // * Splicing into an O_APPEND file fails, but only once the bytes already
+    // * left the socket. Better to refuse before that.
+    int flags = fcntl(out_fd, F_GETFL);
+    if(flags == -1) return -1;
+    if(flags & O_APPEND) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    int pipe_fds[2];
+    if(pipe2(pipe_fds, O_CLOEXEC) < 0) return -1;
+    // * Bigger rounds, failing to grow the pipe is fine
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, IMHTTP_NET_SPLICE_PIPE_SIZE);
+
+    ssize_t moved = 0;
+    while((size_t) moved < count) {
+	ssize_t in = splice(sd, NULL, pipe_fds[1], NULL, count - moved, SPLICE_F_MOVE | SPLICE_F_MORE);
+	if(in < 0 && errno == EINTR) continue;
+	if(in == 0) break;
+	if(in < 0) {
+	    moved = -1;
+	    break;
+	}
+
+	// * The pipe has to be empty again before the next round
+	while(in > 0) {
+	    ssize_t out = splice(pipe_fds[0], NULL, out_fd, NULL, in, SPLICE_F_MOVE | SPLICE_F_MORE);
+	    if(out < 0 && errno == EINTR) continue;
+	    if(out <= 0) {
+		// * What is stuck in the pipe is lost, so not EINVAL: the caller
+		// * must not fall back to copying a body that is partly gone
+		if(out == 0 || errno == EINVAL) errno = EIO;
+		break;
+	    }
+	    in -= out;
+	    moved += out;
+	}
+	if(in > 0) {
+	    moved = -1;
+	    break;
+	}
+    }
+
+    int saved_errno = errno;
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    errno = saved_errno;
+    return moved;
+}
+
+// * `imhttp` is only there to record the phases, it may be NULL
+static int imhttp_net_connect_phases(ImHTTP *imhttp, const char *host, const char *port) {
+    // * Resolve the host (DNS Resolution)
+    IMHTTP_STATS_MARK(imhttp, IMHTTP_PHASE_DNS_BEGIN);
+    ImHTTP_Addresses addresses;
+    if(!imhttp_net_resolve(host, port, &addresses)) {
+	return -1;
+    }
+    IMHTTP_STATS_MARK(imhttp, IMHTTP_PHASE_DNS_END);
+    IMHTTP_STATS_MARK(imhttp, IMHTTP_PHASE_CONNECT_BEGIN);
+
+    int sd = imhttp_net_connect_addresses(&addresses, NULL);
+    if(sd != -1) IMHTTP_STATS_MARK(imhttp, IMHTTP_PHASE_CONNECT_END);
+
+    return sd;
+}
+
+int imhttp_net_connect(const char *host, const char *port) {
+    return imhttp_net_connect_phases(NULL, host, port);
+}
+
+static int64_t net_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// * RFC 8305 section 4: alternate the families, starting with the first one
+static void net_interleave(const ImHTTP_Addresses *addresses, size_t *order) {
+    const sa_family_t first = addresses->items[0].addr.ss_family;
+    size_t same = 0;
+    size_t other = 0;
+    for(size_t i = 0; i < addresses->count; ++i) {
+	bool want_first = i % 2 == 0;
+	// * Skips ahead to the next address of the wanted family, if it has any left
+	while(same < addresses->count && addresses->items[same].addr.ss_family != first) same += 1;
+	while(other < addresses->count && addresses->items[other].addr.ss_family == first) other += 1;
+	if(same == addresses->count) want_first = false;
+	if(other == addresses->count) want_first = true;
+	order[i] = want_first ? same++ : other++;
+    }
+}
+
+// * Options that have to be there before the SYN goes out
+static int net_attempt(const ImHTTP_Address *address, const ImHTTP_Net_Options *options, bool fast_open) {
+    int sd = socket(address->addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+    if(sd == -1) return -1;
+
+    int flags = fcntl(sd, F_GETFL);
+    if(flags == -1 || fcntl(sd, F_SETFL, flags | O_NONBLOCK) == -1) goto fail;
+    // * The window scale is negotiated with the SYN, the buffers can't grow past it later
+    if(options->recv_buffer > 0
+       && setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &options->recv_buffer, sizeof(options->recv_buffer)) < 0) goto fail;
+    if(options->send_buffer > 0
+       && setsockopt(sd, SOL_SOCKET, SO_SNDBUF, &options->send_buffer, sizeof(options->send_buffer)) < 0) goto fail;
+    if(fast_open) {
+	int on = 1;
+	// * Not supported by the kernel is not a reason to fail the connect
+	setsockopt(sd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on));
+    }
+
+    if(connect(sd, (const struct sockaddr *) &address->addr, address->addr_len) == 0 || errno == EINPROGRESS) {
+	return sd;
+    }
+
+fail: {
+	int saved_errno = errno;
+	close(sd);
+	errno = saved_errno;
+	return -1;
+    }
+}
+
+static bool net_finish(int sd, const ImHTTP_Net_Options *options) {
+    int flags = fcntl(sd, F_GETFL);
+    if(flags == -1 || fcntl(sd, F_SETFL, flags & ~O_NONBLOCK) == -1) return false;
+    if(!options->nagle) {
+	int on = 1;
+	if(setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0) return false;
+    }
+    return true;
+}
+
+int imhttp_net_connect_addresses(const ImHTTP_Addresses *addresses, const ImHTTP_Net_Options *options) {
+    static const ImHTTP_Net_Options defaults = {0};
+    if(options == NULL) options = &defaults;
+    const int attempt_delay_ms = options->attempt_delay_ms > 0 ? options->attempt_delay_ms : IMHTTP_NET_DEFAULT_ATTEMPT_DELAY_MS;
+
+    if(addresses->count == 0) {
+	errno = EHOSTUNREACH;
+	return -1;
+    }
+    assert(addresses->count <= IMHTTP_NET_MAX_ADDRESSES);
+
+    size_t order[IMHTTP_NET_MAX_ADDRESSES];
+    net_interleave(addresses, order);
+
+    // * With a cookie cached, a Fast Open connect() succeeds right away and
+    // * the SYN only leaves with the first write. Such a socket would win
+    // * the race whether its address is reachable or not, so only a lone
+    // * address gets it.
+    const bool fast_open = options->fast_open && addresses->count == 1;
+
+    // * Attempts in flight
+    struct pollfd attempts[IMHTTP_NET_MAX_ADDRESSES];
+    size_t attempts_count = 0;
+    size_t next = 0;
+    int winner = -1;
+    int last_errno = EHOSTUNREACH;
+
+    const int64_t deadline = options->timeout_ms > 0 ? net_now_ms() + options->timeout_ms : -1;
+    int64_t next_attempt_at = net_now_ms();
+
+    while(winner == -1) {
+	int64_t now = net_now_ms();
+	if(deadline >= 0 && now >= deadline) {
+	    last_errno = ETIMEDOUT;
+	    break;
+	}
+
+	// * Nothing to wait for makes the next attempt due right away
+	if(next < addresses->count && (attempts_count == 0 || now >= next_attempt_at)) {
+	    int sd = net_attempt(&addresses->items[order[next++]], options, fast_open);
+	    if(sd == -1) {
+		last_errno = errno;
+		continue;
+	    }
+	    attempts[attempts_count].fd = sd;
+	    attempts[attempts_count].events = POLLOUT;
+	    attempts[attempts_count].revents = 0;
+	    attempts_count += 1;
+	    next_attempt_at = now + attempt_delay_ms;
+	    continue;
+	}
+	if(attempts_count == 0) break;
+
+	int timeout = -1;
+	if(next < addresses->count) timeout = (int) (next_attempt_at - now);
+	if(deadline >= 0 && (timeout < 0 || deadline - now < timeout)) timeout = (int) (deadline - now);
+
+	int n = poll(attempts, attempts_count, timeout);
+	if(n < 0) {
+	    if(errno == EINTR) continue;
+	    last_errno = errno;
+	    break;
+	}
+
+	for(size_t i = 0; i < attempts_count && winner == -1; ) {
+	    if(attempts[i].revents == 0) {
+		i += 1;
+		continue;
+	    }
+
+	    int error = 0;
+	    socklen_t error_len = sizeof(error);
+	    if(getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0) error = errno;
+	    if(error == 0) {
+		winner = attempts[i].fd;
+	    } else {
+		close(attempts[i].fd);
+		last_errno = error;
+		// * A failure starts the next attempt without waiting for the delay
+		next_attempt_at = now;
+	    }
+	    // * Either way it is not in the race anymore
+	    attempts[i] = attempts[--attempts_count];
+	}
+    }
+
+    // * Cancels the attempts that lost
+    for(size_t i = 0; i < attempts_count; ++i) {
+	close(attempts[i].fd);
+    }
+
+    if(winner != -1 && !net_finish(winner, options)) {
+	last_errno = errno;
+	close(winner);
+	winner = -1;
+    }
+    if(winner == -1) errno = last_errno;
+    return winner;
+}
+
+bool imhttp_net_open(ImHTTP *imhttp, const char *host, const char *port) {
+    int sd = imhttp_net_connect_phases(imhttp, host, port);
+    if(sd == -1) return false;
+    imhttp_net_attach(imhttp, sd);
+    return true;
+}
+
+void imhttp_net_attach(ImHTTP *imhttp, int sd) {
+    imhttp->socket = (void*) (int64_t) sd;
+    imhttp->write = imhttp_net_write;
+    imhttp->read = imhttp_net_read;
+    imhttp->writev = imhttp_net_writev;
+    imhttp->sendfile = imhttp_net_sendfile;
+    imhttp->splice = imhttp_net_splice;
+}
+
+int imhttp_net_socket(const ImHTTP *imhttp) {
+    return (int) (int64_t) imhttp->socket;
+}
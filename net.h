@@ -0,0 +1,76 @@
+#ifndef NET_H_
+#define NET_H_
+
+#include<stdbool.h>
+#include<stddef.h>
+#include<sys/types.h>
+#include<sys/socket.h>
+
+#include "./imhttp.h"
+
+// * Blocking BSD socket transport for ImHTTP.
+// * The file descriptor is stored directly in ImHTTP_Socket.
+
+#define IMHTTP_NET_MAX_ADDRESSES 8
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+} ImHTTP_Address;
+
+// * Resolved addresses of one host:port, in the order they should be tried
+typedef struct {
+    ImHTTP_Address items[IMHTTP_NET_MAX_ADDRESSES];
+    size_t count;
+} ImHTTP_Addresses;
+
+// * How imhttp_net_connect_addresses() connects. Zero means the default everywhere.
+typedef struct {
+    // * Delay before the next address is tried while the previous attempts are still pending
+    int attempt_delay_ms;
+    // * Gives up on the whole race after that long. 0 leaves it to the kernel.
+    int timeout_ms;
+    // * SO_RCVBUF and SO_SNDBUF. 0 keeps the kernel's (auto-tuned) sizes.
+    int recv_buffer;
+    int send_buffer;
+    // * Keeps Nagle's algorithm, TCP_NODELAY is set otherwise
+    bool nagle;
+    // * TCP_FASTOPEN_CONNECT: with a cookie from an earlier connection the
+    // * request goes out with the SYN. Needs the client bit of net.ipv4.tcp_fastopen.
+    // * Only used when there is a single address: a race needs real handshakes.
+    bool fast_open;
+} ImHTTP_Net_Options;
+
+#define IMHTTP_NET_DEFAULT_ATTEMPT_DELAY_MS 250
+// * Pipe size asked for by imhttp_net_splice(), the kernel may give less
+#define IMHTTP_NET_SPLICE_PIPE_SIZE (1024 * 1024)
+
+// * Writes to a closed connection fail with EPIPE, they never raise SIGPIPE.
+// * sendfile(2) has no such flag: ignore SIGPIPE when sending files.
+ssize_t imhttp_net_write(ImHTTP_Socket socket, const void *buf, size_t count);
+ssize_t imhttp_net_read(ImHTTP_Socket socket, void *buf, size_t count);
+ssize_t imhttp_net_writev(ImHTTP_Socket socket, const ImHTTP_Iovec *iov, int iovcnt);
+ssize_t imhttp_net_sendfile(ImHTTP_Socket socket, int in_fd, int64_t *offset, size_t count);
+// * splice(2) from the socket into a pipe and from the pipe into `out_fd`
+ssize_t imhttp_net_splice(ImHTTP_Socket socket, int out_fd, size_t count);
+
+// * Resolves `host` and connects to the first address that accepts.
+// * Returns the socket descriptor or -1 (errno is preserved).
+int imhttp_net_connect(const char *host, const char *port);
+// * Blocking getaddrinfo() of both IPv4 and IPv6 addresses
+bool imhttp_net_resolve(const char *host, const char *port, ImHTTP_Addresses *addresses);
+// * Happy Eyeballs (RFC 8305). Starts a non-blocking connect to the next
+// * address every `attempt_delay_ms` (or as soon as an attempt fails),
+// * alternating address families, keeps the first one that connects and
+// * closes the others. The socket is blocking again when returned.
+// * `options` may be NULL.
+int imhttp_net_connect_addresses(const ImHTTP_Addresses *addresses, const ImHTTP_Net_Options *options);
+// * Same as imhttp_net_connect() followed by imhttp_net_attach(), but the
+// * DNS and connect phases end up in imhttp->stats (with IMHTTP_STATS)
+bool imhttp_net_open(ImHTTP *imhttp, const char *host, const char *port);
+
+// * Points `imhttp` at the socket `sd` using the callbacks above
+void imhttp_net_attach(ImHTTP *imhttp, int sd);
+int imhttp_net_socket(const ImHTTP *imhttp);
+
+#endif // * NET_H_
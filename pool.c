@@ -0,0 +1,166 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<time.h>
+#include<assert.h>
+
+#include<sys/types.h>
+#include<sys/socket.h>
+#include<unistd.h>
+
+#include "./pool.h"
+#include "./net.h"
+
+static double pool_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double pool_idle_timeout(const ImHTTP_Pool *pool) {
+    return pool->idle_timeout > 0 ? pool->idle_timeout : IMHTTP_POOL_DEFAULT_IDLE_TIMEOUT;
+}
+
+static size_t pool_max_idle_per_host(const ImHTTP_Pool *pool) {
+    return pool->max_idle_per_host > 0 ? pool->max_idle_per_host : IMHTTP_POOL_DEFAULT_MAX_IDLE_PER_HOST;
+}
+
+static bool pool_conn_matches(const ImHTTP_Pool_Conn *conn, const char *host, const char *port) {
+    return strcmp(conn->host, host) == 0 && strcmp(conn->port, port) == 0;
+}
+
+// * An idle keep-alive connection must have nothing to read. EOF means the
+// * server closed it, anything else is garbage we can't attribute to a request.
+static bool pool_conn_is_healthy(const ImHTTP_Pool_Conn *conn) {
+    if(conn->imhttp->rollin_buffer_size > 0) return false;
+
+    char byte;
+    ssize_t n = recv(imhttp_net_socket(conn->imhttp), &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static void pool_remove(ImHTTP_Pool *pool, size_t i) {
+    assert(i < pool->count);
+    close(imhttp_net_socket(pool->items[i].imhttp));
+    imhttp_free(pool->items[i].imhttp);
+    free(pool->items[i].imhttp);
+    pool->items[i] = pool->items[--pool->count];
+}
+
+static ImHTTP_Pool_Conn *pool_push(ImHTTP_Pool *pool) {
+    if(pool->count >= pool->capacity) {
+	size_t new_capacity = pool->capacity == 0 ? 16 : pool->capacity * 2;
+	ImHTTP_Pool_Conn *new_items = realloc(pool->items, new_capacity * sizeof(*pool->items));
+	if(new_items == NULL) return NULL;
+	pool->items = new_items;
+	pool->capacity = new_capacity;
+    }
+    ImHTTP_Pool_Conn *conn = &pool->items[pool->count++];
+    memset(conn, 0, sizeof(*conn));
+    return conn;
+}
+
+void imhttp_pool_evict_stale(ImHTTP_Pool *pool) {
+    double now = pool_now();
+    double timeout = pool_idle_timeout(pool);
+    for(size_t i = 0; i < pool->count; ) {
+	if(pool->items[i].idle && now - pool->items[i].idle_since > timeout) {
+	    pool_remove(pool, i);
+	} else {
+	    i += 1;
+	}
+    }
+}
+
+ImHTTP *imhttp_pool_acquire(ImHTTP_Pool *pool, const char *host, const char *port) {
+    assert(strlen(host) < IMHTTP_POOL_HOST_CAPACITY);
+    assert(strlen(port) < IMHTTP_POOL_PORT_CAPACITY);
+
+    imhttp_pool_evict_stale(pool);
+
+    // * Prefer the most recently used connection, it is the least likely to be dropped
+    for(;;) {
+	ImHTTP_Pool_Conn *best = NULL;
+	for(size_t i = 0; i < pool->count; ++i) {
+	    ImHTTP_Pool_Conn *conn = &pool->items[i];
+	    if(conn->idle && pool_conn_matches(conn, host, port)) {
+		if(best == NULL || conn->idle_since > best->idle_since) best = conn;
+	    }
+	}
+	if(best == NULL) break;
+
+	if(pool_conn_is_healthy(best)) {
+	    best->idle = false;
+	    return best->imhttp;
+	}
+	pool_remove(pool, best - pool->items);
+    }
+
+    ImHTTP_Addresses addresses;
+    bool resolved = pool->dns != NULL
+	? imhttp_dns_resolve_wait(pool->dns, host, port, &addresses)
+	: imhttp_net_resolve(host, port, &addresses);
+    if(!resolved) return NULL;
+    int sd = imhttp_net_connect_addresses(&addresses, &pool->net);
+    if(sd < 0) return NULL;
+
+    ImHTTP *imhttp = calloc(1, sizeof(*imhttp));
+    ImHTTP_Pool_Conn *conn = imhttp ? pool_push(pool) : NULL;
+    if(conn == NULL) {
+	free(imhttp);
+	close(sd);
+	return NULL;
+    }
+
+    imhttp_net_attach(imhttp, sd);
+    strcpy(conn->host, host);
+    strcpy(conn->port, port);
+    conn->imhttp = imhttp;
+    conn->idle = false;
+    return imhttp;
+}
+
+void imhttp_pool_release(ImHTTP_Pool *pool, ImHTTP *imhttp) {
+    size_t i = 0;
+    while(i < pool->count && pool->items[i].imhttp != imhttp) i += 1;
+    assert(i < pool->count && "imhttp_pool_release: the connection does not belong to this pool");
+
+    ImHTTP_Pool_Conn *conn = &pool->items[i];
+    assert(!conn->idle && "imhttp_pool_release: the connection was released twice");
+
+    // * The server asked to close it, a request could not be written or some
+    // * response was not fully consumed
+    if(!imhttp->keep_alive || imhttp->req_error != NULL
+       || imhttp->res_state != IMHTTP_RES_DONE || imhttp->requests_in_flight > 0) {
+	pool_remove(pool, i);
+	return;
+    }
+
+    conn->idle = true;
+    conn->idle_since = pool_now();
+
+    // * Too many idle connections to this host, drop the one idle the longest
+    size_t idle_count = 0;
+    ImHTTP_Pool_Conn *oldest = NULL;
+    for(size_t j = 0; j < pool->count; ++j) {
+	ImHTTP_Pool_Conn *other = &pool->items[j];
+	if(other->idle && pool_conn_matches(other, conn->host, conn->port)) {
+	    idle_count += 1;
+	    if(oldest == NULL || other->idle_since < oldest->idle_since) oldest = other;
+	}
+    }
+    if(idle_count > pool_max_idle_per_host(pool)) {
+	pool_remove(pool, oldest - pool->items);
+    }
+}
+
+void imhttp_pool_free(ImHTTP_Pool *pool) {
+    while(pool->count > 0) {
+	pool_remove(pool, pool->count - 1);
+    }
+    free(pool->items);
+    memset(pool, 0, sizeof(*pool));
+}
@@ -0,0 +1,57 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include<stdbool.h>
+#include<stddef.h>
+
+#include "./imhttp.h"
+#include "./dns.h"
+
+// * Keep-alive connection pool keyed by host:port.
+// *
+// * imhttp_pool_acquire() hands out an idle connection to host:port if
+// * there is a healthy one, otherwise it connects a new one.
+// * imhttp_pool_release() takes it back once the response is over
+// * (after imhttp_res_end()). Connections the server asked to close, idle
+// * ones older than idle_timeout and ones the server silently dropped are
+// * closed instead of being handed out again.
+
+#define IMHTTP_POOL_HOST_CAPACITY 256
+#define IMHTTP_POOL_PORT_CAPACITY 16
+
+typedef struct {
+    char host[IMHTTP_POOL_HOST_CAPACITY];
+    char port[IMHTTP_POOL_PORT_CAPACITY];
+    ImHTTP *imhttp;
+    bool idle;
+    double idle_since;
+} ImHTTP_Pool_Conn;
+
+typedef struct {
+    ImHTTP_Pool_Conn *items;
+    size_t count;
+    size_t capacity;
+
+    // * Seconds an idle connection is kept around. 0 means the default.
+    double idle_timeout;
+    // * Idle connections kept per host:port. 0 means the default.
+    size_t max_idle_per_host;
+    // * Optional. New connections resolve through it (and its cache)
+    // * instead of a fresh getaddrinfo() each.
+    ImHTTP_Dns *dns;
+    // * How new connections are made, see imhttp_net_connect_addresses()
+    ImHTTP_Net_Options net;
+} ImHTTP_Pool;
+
+#define IMHTTP_POOL_DEFAULT_IDLE_TIMEOUT 30.0
+#define IMHTTP_POOL_DEFAULT_MAX_IDLE_PER_HOST 8
+
+// * Returns NULL if a new connection was needed and could not be established
+ImHTTP *imhttp_pool_acquire(ImHTTP_Pool *pool, const char *host, const char *port);
+void imhttp_pool_release(ImHTTP_Pool *pool, ImHTTP *imhttp);
+// * Closes the idle connections that timed out
+void imhttp_pool_evict_stale(ImHTTP_Pool *pool);
+// * Closes everything, including the connections that are still handed out
+void imhttp_pool_free(ImHTTP_Pool *pool);
+
+#endif // * POOL_H_
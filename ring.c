@@ -0,0 +1,43 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "ring.h"
+
+char *ring_mirror_alloc(size_t capacity) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    if(page_size <= 0 || capacity == 0 || capacity % (size_t) page_size != 0) return NULL;
+
+    int fd = memfd_create("imhttp-ring", MFD_CLOEXEC);
+    if(fd < 0) return NULL;
+
+    if(ftruncate(fd, capacity) < 0) {
+	close(fd);
+	return NULL;
+    }
+
+    // * Reserve the address space for both halves first so nobody else
+    // * can sneak a mapping in between them
+    char *ring = mmap(NULL, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ring == MAP_FAILED) {
+	close(fd);
+	return NULL;
+    }
+
+    void *lo = mmap(ring, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    void *hi = mmap(ring + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    close(fd);
+
+    if(lo == MAP_FAILED || hi == MAP_FAILED) {
+	munmap(ring, 2 * capacity);
+	return NULL;
+    }
+
+    return ring;
+}
+
+void ring_mirror_free(char *ring, size_t capacity) {
+    if(ring) munmap(ring, 2 * capacity);
+}
@@ -0,0 +1,13 @@
+#ifndef RING_H_
+#define RING_H_
+
+#include<stddef.h>
+
+// * Double-mapped ring buffer storage for imhttp_set_rollin_buffer().
+// * The same `capacity` bytes are mapped twice back to back so any range
+// * [i, i + n) with i < capacity and n <= capacity is contiguous in memory.
+// * `capacity` must be a multiple of the page size. Returns NULL on failure.
+char *ring_mirror_alloc(size_t capacity);
+void ring_mirror_free(char *ring, size_t capacity);
+
+#endif // * RING_H_
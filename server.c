@@ -0,0 +1,498 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<ctype.h>
+#include<stdbool.h>
+#include<signal.h>
+#include<assert.h>
+
+#include<sys/types.h>
+#include<sys/socket.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+#include<arpa/inet.h>
+#include<unistd.h>
+
+#include<zlib.h>
+
+#include "./sv.h"
+
+// * Local stand-in HTTP/1.1 server for the benchmarks.
+// *
+// * Listens on 127.0.0.1, prints the port it got to stdout and serves every
+// * connection in a forked child. Keep-alive and pipelining are supported:
+// * all the complete requests found in one read are answered with one write.
+// * "Connection: close" in a request closes the connection after its response.
+// * Request bodies of any size are read, the ones that do not fit into the
+// * input buffer are discarded.
+// *
+// * Response shapes are picked by the request path:
+// *   /bytes/<n>    <n> bytes of body with Content-Length (streamed if big)
+// *   /headers/<n>  <n> extra header fields and a short body
+// *   /chunked/<n>  <n> bytes of body in SERVER_CHUNK_SIZE chunks
+// *   /json/<n>     <n> bytes of JSON-like text with Content-Length
+// *   /gzip/<n>     the same text gzip compressed, with Content-Length
+// *   /gzip-chunked/<n>  the same, in SERVER_CHUNK_SIZE chunks
+// *   /file/<n>     <n> bytes made of their own 8-byte offsets (little
+// *                 endian), so misplaced bytes show. Honors a single
+// *                 "Range: bytes=" range with 206 or 416.
+// *   /file-cut/<n>  the same, except that a range starting at an 8-byte
+// *                 boundary stops after an odd number of bytes and the
+// *                 connection is closed. The rest, asked for again from
+// *                 there, is unaligned and comes whole.
+// *   anything else a short greeting
+
+#define SERVER_INPUT_CAPACITY (64 * 1024)
+#define SERVER_OUTPUT_CAPACITY (256 * 1024)
+#define SERVER_CHUNK_SIZE (4 * 1024)
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} Server_Buffer;
+
+static void buffer_reserve(Server_Buffer *buffer, size_t extra) {
+    if(buffer->size + extra <= buffer->capacity) return;
+    size_t new_capacity = buffer->capacity == 0 ? SERVER_OUTPUT_CAPACITY : buffer->capacity;
+    while(new_capacity < buffer->size + extra) new_capacity *= 2;
+    buffer->data = realloc(buffer->data, new_capacity);
+    assert(buffer->data != NULL);
+    buffer->capacity = new_capacity;
+}
+
+static void buffer_append(Server_Buffer *buffer, const void *data, size_t size) {
+    buffer_reserve(buffer, size);
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+static void buffer_append_cstr(Server_Buffer *buffer, const char *cstr) {
+    buffer_append(buffer, cstr, strlen(cstr));
+}
+
+static void buffer_fill(Server_Buffer *buffer, char c, size_t size) {
+    buffer_reserve(buffer, size);
+    memset(buffer->data + buffer->size, c, size);
+    buffer->size += size;
+}
+
+static bool write_all(int sd, const char *data, size_t size) {
+    while(size > 0) {
+	ssize_t n = write(sd, data, size);
+	if(n <= 0) return false;
+	data += n;
+	size -= n;
+    }
+    return true;
+}
+
+// * Big bodies do not go through `out`, it is flushed and the body is
+// * written straight from a block of filler bytes
+static bool respond_body(int sd, Server_Buffer *out, uint64_t size) {
+    if(size <= SERVER_OUTPUT_CAPACITY) {
+	buffer_fill(out, 'x', size);
+	return true;
+    }
+
+    static char filler[SERVER_OUTPUT_CAPACITY];
+    if(filler[0] != 'x') memset(filler, 'x', sizeof(filler));
+
+    if(!write_all(sd, out->data, out->size)) return false;
+    out->size = 0;
+    while(size > 0) {
+	size_t n = size < sizeof(filler) ? size : sizeof(filler);
+	if(!write_all(sd, filler, n)) return false;
+	size -= n;
+    }
+    return true;
+}
+
+// * Writes bytes [begin, end) of a /file/<n> resource: byte i is byte i % 8
+// * of the little endian 64-bit number i - i % 8
+static bool respond_file(int sd, Server_Buffer *out, uint64_t begin, uint64_t end) {
+    static char block[SERVER_OUTPUT_CAPACITY];
+    if(!write_all(sd, out->data, out->size)) return false;
+    out->size = 0;
+
+    while(begin < end) {
+	// * Blocks start at 8-byte boundaries, the first one maybe in the middle
+	uint64_t base = begin - begin % 8;
+	size_t count = 0;
+	for(uint64_t word = base; count < sizeof(block) && word < end; word += 8) {
+	    for(int i = 0; i < 8; ++i) block[count++] = (char) (word >> (8 * i));
+	}
+	size_t skip = begin - base;
+	size_t n = count - skip;
+	if(n > end - begin) n = end - begin;
+	if(!write_all(sd, block + skip, n)) return false;
+	begin += n;
+    }
+    return true;
+}
+
+// * Parses "bytes=<first>-<last>", "bytes=<first>-" and "bytes=-<suffix>"
+// * into [begin, end) of a resource of `size` bytes
+static bool parse_range(String_View range, uint64_t size, uint64_t *begin, uint64_t *end) {
+    String_View unit = sv_chop_by_delim(&range, '=');
+    if(!sv_eq_ignorecase(unit, cstr_to_sv("bytes"))) return false;
+    String_View first = sv_chop_by_delim(&range, '-');
+    sv_trim(&first);
+    sv_trim(&range);
+
+    uint64_t a = 0, b = 0;
+    if(first.count == 0) {
+	if(sv_parse_u64(range, &b) != SV_PARSE_OK || b == 0) return false;
+	*begin = b < size ? size - b : 0;
+	*end = size;
+    } else {
+	if(sv_parse_u64(first, &a) != SV_PARSE_OK) return false;
+	if(range.count == 0) {
+	    b = UINT64_MAX;
+	} else if(sv_parse_u64(range, &b) != SV_PARSE_OK || b < a) {
+	    return false;
+	}
+	*begin = a;
+	*end = b < size ? b + 1 : size;
+    }
+    return *begin < *end;
+}
+
+// * The text of the /json/<n> responses. The last one asked for is kept.
+static const char *json_text(size_t size) {
+    static char *text = NULL;
+    static size_t text_size = 0;
+    if(text != NULL && text_size == size) return text;
+
+    free(text);
+    text = malloc(size + 1);
+    assert(text != NULL);
+    size_t filled = 0;
+    for(size_t id = 0; filled < size; ++id) {
+	char item[128];
+	int n = snprintf(item, sizeof(item),
+			 "{\"id\":%zu,\"name\":\"item-%zu\",\"price\":%zu.%02zu,\"tags\":[\"bench\",\"json\"]},",
+			 id, id, id % 1000, id % 100);
+	size_t count = (size_t) n < size - filled ? (size_t) n : size - filled;
+	memcpy(text + filled, item, count);
+	filled += count;
+    }
+    text_size = size;
+    return text;
+}
+
+// * json_text(size) gzip compressed, the last one asked for is kept
+static const char *gzip_text(size_t size, size_t *compressed_size) {
+    static char *compressed = NULL;
+    static size_t compressed_for = SIZE_MAX;
+    static size_t compressed_count = 0;
+    if(compressed != NULL && compressed_for == size) {
+	*compressed_size = compressed_count;
+	return compressed;
+    }
+
+    const char *text = json_text(size);
+    z_stream stream = {0};
+    // * 16 + 15 asks for the gzip wrapper
+    int ret = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY);
+    assert(ret == Z_OK);
+    size_t bound = deflateBound(&stream, size);
+    free(compressed);
+    compressed = malloc(bound);
+    assert(compressed != NULL);
+    stream.next_in = (Bytef *) text;
+    stream.avail_in = size;
+    stream.next_out = (Bytef *) compressed;
+    stream.avail_out = bound;
+    ret = deflate(&stream, Z_FINISH);
+    assert(ret == Z_STREAM_END);
+    (void) ret;
+    compressed_count = stream.total_out;
+    compressed_for = size;
+    deflateEnd(&stream);
+
+    *compressed_size = compressed_count;
+    return compressed;
+}
+
+static bool chop_prefix(String_View *path, const char *prefix) {
+    String_View prefix_sv = cstr_to_sv((char *) prefix);
+    if(!sv_starts_with(*path, prefix_sv)) return false;
+    path->data += prefix_sv.count;
+    path->count -= prefix_sv.count;
+    return true;
+}
+
+// * `range` is the value of the Range header, data == NULL without one
+static bool respond(int sd, Server_Buffer *out, String_View path, String_View range) {
+    char head[256];
+
+    const bool cut = chop_prefix(&path, "/file-cut/");
+    if(cut || chop_prefix(&path, "/file/")) {
+	uint64_t size = sv_to_u64(path);
+	if(range.data == NULL) {
+	    int n = snprintf(head, sizeof(head),
+			     "HTTP/1.1 200 OK\r\nAccept-Ranges: bytes\r\nContent-Length: %llu\r\n\r\n",
+			     (unsigned long long) size);
+	    buffer_append(out, head, n);
+	    return respond_file(sd, out, 0, size);
+	}
+
+	uint64_t begin, end;
+	if(!parse_range(range, size, &begin, &end)) {
+	    int n = snprintf(head, sizeof(head),
+			     "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%llu\r\nContent-Length: 0\r\n\r\n",
+			     (unsigned long long) size);
+	    buffer_append(out, head, n);
+	    return true;
+	}
+	int n = snprintf(head, sizeof(head),
+			 "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %llu-%llu/%llu\r\nContent-Length: %llu\r\n\r\n",
+			 (unsigned long long) begin, (unsigned long long) end - 1,
+			 (unsigned long long) size, (unsigned long long) (end - begin));
+	buffer_append(out, head, n);
+	if(cut && begin % 8 == 0 && end - begin > 1) {
+	    respond_file(sd, out, begin, begin + ((end - begin) / 2 | 1));
+	    return false;
+	}
+	return respond_file(sd, out, begin, end);
+    }
+
+    if(chop_prefix(&path, "/bytes/")) {
+	uint64_t body_size = sv_to_u64(path);
+	int n = snprintf(head, sizeof(head),
+			 "HTTP/1.1 200 OK\r\nContent-Length: %llu\r\n\r\n",
+			 (unsigned long long) body_size);
+	buffer_append(out, head, n);
+	return respond_body(sd, out, body_size);
+    }
+
+    if(chop_prefix(&path, "/chunked/")) {
+	uint64_t body_size = sv_to_u64(path);
+	buffer_append_cstr(out, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+	while(body_size > 0) {
+	    size_t chunk_size = body_size < SERVER_CHUNK_SIZE ? body_size : SERVER_CHUNK_SIZE;
+	    int n = snprintf(head, sizeof(head), "%zx\r\n", chunk_size);
+	    buffer_append(out, head, n);
+	    buffer_fill(out, 'x', chunk_size);
+	    buffer_append_cstr(out, "\r\n");
+	    body_size -= chunk_size;
+
+	    if(out->size >= SERVER_OUTPUT_CAPACITY) {
+		if(!write_all(sd, out->data, out->size)) return false;
+		out->size = 0;
+	    }
+	}
+	buffer_append_cstr(out, "0\r\n\r\n");
+	return true;
+    }
+
+    if(chop_prefix(&path, "/json/")) {
+	size_t body_size = sv_to_u64(path);
+	int n = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n", body_size);
+	buffer_append(out, head, n);
+	buffer_append(out, json_text(body_size), body_size);
+	return true;
+    }
+
+    if(chop_prefix(&path, "/gzip/")) {
+	size_t body_size = 0;
+	const char *body = gzip_text(sv_to_u64(path), &body_size);
+	int n = snprintf(head, sizeof(head),
+			 "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Encoding: gzip\r\nContent-Length: %zu\r\n\r\n",
+			 body_size);
+	buffer_append(out, head, n);
+	buffer_append(out, body, body_size);
+	return true;
+    }
+
+    if(chop_prefix(&path, "/gzip-chunked/")) {
+	size_t body_size = 0;
+	const char *body = gzip_text(sv_to_u64(path), &body_size);
+	buffer_append_cstr(out, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n\r\n");
+	for(size_t sent = 0; sent < body_size; ) {
+	    size_t chunk_size = body_size - sent < SERVER_CHUNK_SIZE ? body_size - sent : SERVER_CHUNK_SIZE;
+	    int n = snprintf(head, sizeof(head), "%zx\r\n", chunk_size);
+	    buffer_append(out, head, n);
+	    buffer_append(out, body + sent, chunk_size);
+	    buffer_append_cstr(out, "\r\n");
+	    sent += chunk_size;
+	}
+	buffer_append_cstr(out, "0\r\n\r\n");
+	return true;
+    }
+
+    const char *body = "Hello, World!\n";
+    if(chop_prefix(&path, "/headers/")) {
+	uint64_t headers_count = sv_to_u64(path);
+	buffer_append_cstr(out, "HTTP/1.1 200 OK\r\n");
+	for(uint64_t i = 0; i < headers_count; ++i) {
+	    int n = snprintf(head, sizeof(head),
+			     "X-Bench-Header-%03llu: some moderately long value %llu\r\n",
+			     (unsigned long long) i, (unsigned long long) i);
+	    buffer_append(out, head, n);
+	}
+    } else {
+	buffer_append_cstr(out, "HTTP/1.1 200 OK\r\n");
+    }
+
+    int n = snprintf(head, sizeof(head), "Content-Length: %zu\r\n\r\n", strlen(body));
+    buffer_append(out, head, n);
+    buffer_append(out, body, strlen(body));
+    return true;
+}
+
+typedef enum {
+    REQUEST_INCOMPLETE,
+    REQUEST_HANDLED,
+    // * Handled, and the connection has to be closed afterwards
+    REQUEST_CLOSE,
+} Request_Status;
+
+// * Stores how many bytes of `input` the request takes into `taken`, and
+// * how many more body bytes are still to come and be skipped into `skip`
+static Request_Status handle_request(int sd, String_View input, Server_Buffer *out, size_t *taken, uint64_t *skip) {
+    size_t headers_end = 0;
+    if(!sv_find_crlfcrlf(input, &headers_end)) return REQUEST_INCOMPLETE;
+
+    String_View head = { .data = input.data, .count = headers_end + 2 };
+    String_View request_line;
+    bool ok = sv_chop_line(&head, &request_line);
+    assert(ok);
+
+    sv_chop_by_delim(&request_line, ' ');
+    String_View path = sv_chop_by_delim(&request_line, ' ');
+
+    uint64_t content_length = 0;
+    bool close = false;
+    String_View range = {0};
+    String_View line;
+    while(sv_chop_line(&head, &line)) {
+	String_View name = sv_chop_by_delim(&line, ':');
+	sv_trim(&line);
+	if(sv_eq_ignorecase(name, cstr_to_sv("Content-Length"))) {
+	    content_length = sv_to_u64(line);
+	} else if(sv_eq_ignorecase(name, cstr_to_sv("Connection"))) {
+	    close = sv_eq_ignorecase(line, cstr_to_sv("close"));
+	} else if(sv_eq_ignorecase(name, cstr_to_sv("Range"))) {
+	    range = line;
+	}
+    }
+
+    size_t request_size = headers_end + 4 + content_length;
+    if(request_size > input.count) {
+	// * Uploads too big for `input` are answered right away and the rest
+	// * of their body is thrown away as it arrives
+	if(request_size <= SERVER_INPUT_CAPACITY) return REQUEST_INCOMPLETE;
+	*skip = request_size - input.count;
+	request_size = input.count;
+    }
+
+    *taken = request_size;
+    if(!respond(sd, out, path, range)) return REQUEST_CLOSE;
+    return close ? REQUEST_CLOSE : REQUEST_HANDLED;
+}
+
+static void serve(int sd) {
+    static char input[SERVER_INPUT_CAPACITY];
+    size_t input_size = 0;
+    uint64_t skip = 0;
+    Server_Buffer out = {0};
+
+    for(;;) {
+	ssize_t n = read(sd, input + input_size, sizeof(input) - input_size);
+	if(n <= 0) break;
+	input_size += n;
+
+	String_View rest = { .data = input, .count = input_size };
+	size_t skipped = skip < rest.count ? skip : rest.count;
+	rest.data += skipped;
+	rest.count -= skipped;
+	skip -= skipped;
+
+	bool close = false;
+	while(!close) {
+	    size_t taken = 0;
+	    Request_Status status = handle_request(sd, rest, &out, &taken, &skip);
+	    if(status == REQUEST_INCOMPLETE) break;
+	    close = status == REQUEST_CLOSE;
+	    rest.data += taken;
+	    rest.count -= taken;
+	}
+	memmove(input, rest.data, rest.count);
+	input_size = rest.count;
+
+	if(input_size == sizeof(input)) {
+	    fprintf(stderr, "imhttp_server: request is too big\n");
+	    break;
+	}
+
+	if(!write_all(sd, out.data, out.size)) break;
+	out.size = 0;
+	if(close) break;
+    }
+
+    free(out.data);
+    close(sd);
+}
+
+int main(int argc, char **argv) {
+    int port = 0;
+    for(int i = 1; i < argc; ++i) {
+	if(strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+	    port = atoi(argv[++i]);
+	} else {
+	    fprintf(stderr, "Usage: %s [-p port]\n", argv[0]);
+	    return 1;
+	}
+    }
+
+    // * Children are never waited for
+    signal(SIGCHLD, SIG_IGN);
+
+    int listen_sd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listen_sd < 0) {
+	fprintf(stderr, "imhttp_server: could not create socket: %s\n", strerror(errno));
+	return 1;
+    }
+
+    int yes = 1;
+    setsockopt(listen_sd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if(bind(listen_sd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listen_sd, 1024) < 0) {
+	fprintf(stderr, "imhttp_server: could not listen on port %d: %s\n", port, strerror(errno));
+	return 1;
+    }
+
+    socklen_t addr_len = sizeof(addr);
+    getsockname(listen_sd, (struct sockaddr *) &addr, &addr_len);
+    printf("%d\n", ntohs(addr.sin_port));
+    fflush(stdout);
+
+    for(;;) {
+	int sd = accept(listen_sd, NULL, NULL);
+	if(sd < 0) {
+	    if(errno == EINTR) continue;
+	    fprintf(stderr, "imhttp_server: accept failed: %s\n", strerror(errno));
+	    return 1;
+	}
+
+	setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+	pid_t pid = fork();
+	if(pid == 0) {
+	    close(listen_sd);
+	    serve(sd);
+	    _exit(0);
+	}
+	close(sd);
+    }
+}
@@ -4,6 +4,157 @@
 
 #include "sv.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SV_SIMD
+#include <immintrin.h>
+#endif
+
+// * Scanning kernels
+// *
+// * Each kernel returns the position of the first match or `n` if there is
+// * none. The scalar ones are the reference implementation and also handle
+// * the tails that are too short for a full vector.
+
+static size_t sv_scan_byte_scalar(const char *data, size_t n, char c) {
+    size_t i = 0;
+    while(i < n && data[i] != c) {
+	i += 1;
+    }
+    return i;
+}
+
+static size_t sv_scan_crlf_scalar(const char *data, size_t n) {
+    for(size_t i = 0; i + 1 < n; ++i) {
+	if(data[i] == '\r' && data[i + 1] == '\n') return i;
+    }
+    return n;
+}
+
+static size_t sv_scan_crlfcrlf_scalar(const char *data, size_t n) {
+    for(size_t i = 0; i + 3 < n; ++i) {
+	if(data[i] == '\r' && data[i + 1] == '\n' && data[i + 2] == '\r' && data[i + 3] == '\n') return i;
+    }
+    return n;
+}
+
+#ifdef SV_SIMD
+
+// * The pattern kernels compare shifted unaligned loads against each
+// * character of the pattern and AND the masks together, so a match that
+// * straddles two vectors is still found in one pass.
+
+static size_t sv_scan_byte_sse2(const char *data, size_t n, char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+	__m128i block = _mm_loadu_si128((const __m128i *) (data + i));
+	unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+	if(mask) return i + __builtin_ctz(mask);
+    }
+    return i + sv_scan_byte_scalar(data + i, n - i, c);
+}
+
+static size_t sv_scan_crlf_sse2(const char *data, size_t n) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for(; i + 17 <= n; i += 16) {
+	__m128i a = _mm_loadu_si128((const __m128i *) (data + i));
+	__m128i b = _mm_loadu_si128((const __m128i *) (data + i + 1));
+	unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, cr), _mm_cmpeq_epi8(b, lf)));
+	if(mask) return i + __builtin_ctz(mask);
+    }
+    size_t j = sv_scan_crlf_scalar(data + i, n - i);
+    return j == n - i ? n : i + j;
+}
+
+static size_t sv_scan_crlfcrlf_sse2(const char *data, size_t n) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for(; i + 19 <= n; i += 16) {
+	__m128i a = _mm_loadu_si128((const __m128i *) (data + i));
+	__m128i b = _mm_loadu_si128((const __m128i *) (data + i + 1));
+	__m128i c = _mm_loadu_si128((const __m128i *) (data + i + 2));
+	__m128i d = _mm_loadu_si128((const __m128i *) (data + i + 3));
+	__m128i ab = _mm_and_si128(_mm_cmpeq_epi8(a, cr), _mm_cmpeq_epi8(b, lf));
+	__m128i cd = _mm_and_si128(_mm_cmpeq_epi8(c, cr), _mm_cmpeq_epi8(d, lf));
+	unsigned mask = _mm_movemask_epi8(_mm_and_si128(ab, cd));
+	if(mask) return i + __builtin_ctz(mask);
+    }
+    size_t j = sv_scan_crlfcrlf_scalar(data + i, n - i);
+    return j == n - i ? n : i + j;
+}
+
+__attribute__((target("avx2")))
+static size_t sv_scan_byte_avx2(const char *data, size_t n, char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32) {
+	__m256i block = _mm256_loadu_si256((const __m256i *) (data + i));
+	unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+	if(mask) return i + __builtin_ctz(mask);
+    }
+    return i + sv_scan_byte_sse2(data + i, n - i, c);
+}
+
+__attribute__((target("avx2")))
+static size_t sv_scan_crlf_avx2(const char *data, size_t n) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for(; i + 33 <= n; i += 32) {
+	__m256i a = _mm256_loadu_si256((const __m256i *) (data + i));
+	__m256i b = _mm256_loadu_si256((const __m256i *) (data + i + 1));
+	unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, cr), _mm256_cmpeq_epi8(b, lf)));
+	if(mask) return i + __builtin_ctz(mask);
+    }
+    size_t j = sv_scan_crlf_sse2(data + i, n - i);
+    return j == n - i ? n : i + j;
+}
+
+__attribute__((target("avx2")))
+static size_t sv_scan_crlfcrlf_avx2(const char *data, size_t n) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for(; i + 35 <= n; i += 32) {
+	__m256i a = _mm256_loadu_si256((const __m256i *) (data + i));
+	__m256i b = _mm256_loadu_si256((const __m256i *) (data + i + 1));
+	__m256i c = _mm256_loadu_si256((const __m256i *) (data + i + 2));
+	__m256i d = _mm256_loadu_si256((const __m256i *) (data + i + 3));
+	__m256i ab = _mm256_and_si256(_mm256_cmpeq_epi8(a, cr), _mm256_cmpeq_epi8(b, lf));
+	__m256i cd = _mm256_and_si256(_mm256_cmpeq_epi8(c, cr), _mm256_cmpeq_epi8(d, lf));
+	unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(ab, cd));
+	if(mask) return i + __builtin_ctz(mask);
+    }
+    size_t j = sv_scan_crlfcrlf_sse2(data + i, n - i);
+    return j == n - i ? n : i + j;
+}
+
+static size_t (*sv_scan_byte)(const char *data, size_t n, char c) = sv_scan_byte_sse2;
+static size_t (*sv_scan_crlf)(const char *data, size_t n) = sv_scan_crlf_sse2;
+static size_t (*sv_scan_crlfcrlf)(const char *data, size_t n) = sv_scan_crlfcrlf_sse2;
+
+// * SSE2 is always there on x86_64, AVX2 is picked once before main()
+__attribute__((constructor))
+static void sv_scan_select(void) {
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+	sv_scan_byte = sv_scan_byte_avx2;
+	sv_scan_crlf = sv_scan_crlf_avx2;
+	sv_scan_crlfcrlf = sv_scan_crlfcrlf_avx2;
+    }
+}
+
+#else
+
+#define sv_scan_byte sv_scan_byte_scalar
+#define sv_scan_crlf sv_scan_crlf_scalar
+#define sv_scan_crlfcrlf sv_scan_crlfcrlf_scalar
+
+#endif // SV_SIMD
+
 String_View cstr_to_sv(char* cstr) {
     return (String_View) {
 	.count = strlen(cstr),
@@ -12,10 +163,7 @@ String_View cstr_to_sv(char* cstr) {
 }
 
 String_View sv_chop_by_delim(String_View *sv, char delim) {
-    size_t i = 0;
-    while(i < sv->count && sv->data[i] != delim) {
-	i += 1;
-    }
+    size_t i = sv_scan_byte(sv->data, sv->count, delim);
 
     String_View result = {
 	.count = i,
@@ -58,6 +206,14 @@ int sv_eq(String_View a, String_View b) {
     return memcmp(a.data, b.data, a.count) == 0;
 }
 
+bool sv_eq_ignorecase(String_View a, String_View b) {
+    if(a.count != b.count) return false;
+    for(size_t i = 0; i < a.count; ++i) {
+	if(tolower((unsigned char) a.data[i]) != tolower((unsigned char) b.data[i])) return false;
+    }
+    return true;
+}
+
 uint64_t sv_to_u64(String_View sv) {
     uint64_t result = 0;
     for(size_t i = 0; (i < sv.count && isdigit(sv.data[i])); ++i) {
@@ -66,6 +222,138 @@ uint64_t sv_to_u64(String_View sv) {
     return result;
 }
 
+uint64_t sv_hex_to_u64(String_View sv) {
+    uint64_t result = 0;
+    for(size_t i = 0; (i < sv.count && isxdigit(sv.data[i])); ++i) {
+	char c = tolower(sv.data[i]);
+	result = result * 16 + (isdigit(c) ? c - '0' : c - 'a' + 10);
+    }
+    return result;
+}
+
+// * SWAR ("SIMD within a register") number parsing
+// *
+// * Eight characters are loaded into a uint64_t, the first one ending up in
+// * the lowest byte, then validated and folded into their value with a few
+// * multiplies: neighbouring digits are combined into pairs, the pairs into
+// * quads and the quads into the final 8-digit value.
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SV_SWAR
+#endif
+
+#define SV_ONES 0x0101010101010101ull
+#define SV_HIGHS 0x8080808080808080ull
+
+#ifdef SV_SWAR
+static uint64_t sv_load8(const char *data) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+// * The high bit of every byte of `word` that is in (low, high). Exact for
+// * 0 <= low and high <= 128.
+static uint64_t sv_bytes_between(uint64_t word, unsigned low, unsigned high) {
+    const uint64_t seven = word & (SV_ONES * 127);
+    return (SV_ONES * (127 + high) - seven) & ~word & (seven + SV_ONES * (127 - low)) & SV_HIGHS;
+}
+
+static bool sv_swar_digits8(const char *data, uint64_t *value) {
+    uint64_t word = sv_load8(data);
+    if(sv_bytes_between(word, '0' - 1, '9' + 1) != SV_HIGHS) return false;
+
+    word -= SV_ONES * '0';
+    word = (word * 10 + (word >> 8)) & 0x00ff00ff00ff00ffull;
+    word = (word * 100 + (word >> 16)) & 0x0000ffff0000ffffull;
+    word = (word * 10000 + (word >> 32)) & 0xffffffffull;
+    *value = word;
+    return true;
+}
+
+static bool sv_swar_hex8(const char *data, uint64_t *value) {
+    uint64_t word = sv_load8(data);
+    const uint64_t valid = sv_bytes_between(word, '0' - 1, '9' + 1)
+	| sv_bytes_between(word, 'a' - 1, 'f' + 1)
+	| sv_bytes_between(word, 'A' - 1, 'F' + 1);
+    if(valid != SV_HIGHS) return false;
+
+    // * Letters have bit 6 set and their low nibble is 9 short of the value
+    word = (word & (SV_ONES * 0x0f)) + ((word >> 6) & SV_ONES) * 9;
+    word = (word * 16 + (word >> 8)) & 0x00ff00ff00ff00ffull;
+    word = (word * 256 + (word >> 16)) & 0x0000ffff0000ffffull;
+    word = (word * 65536 + (word >> 32)) & 0xffffffffull;
+    *value = word;
+    return true;
+}
+#endif
+
+static int sv_hex_digit(char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+Sv_Parse_Result sv_parse_u64(String_View sv, uint64_t *result) {
+    if(sv.count == 0) return SV_PARSE_INVALID;
+
+    uint64_t value = 0;
+    // * 19 digits always fit
+    const bool may_overflow = sv.count > 19;
+    // * Invalid wins over overflow, so the rest is still checked
+    bool overflow = false;
+    size_t i = 0;
+#ifdef SV_SWAR
+    for(; i + 8 <= sv.count; i += 8) {
+	uint64_t digits;
+	if(!sv_swar_digits8(sv.data + i, &digits)) return SV_PARSE_INVALID;
+	if(may_overflow && (value > UINT64_MAX / 100000000 || (value == UINT64_MAX / 100000000 && digits > UINT64_MAX % 100000000))) {
+	    overflow = true;
+	}
+	value = value * 100000000 + digits;
+    }
+#endif
+    for(; i < sv.count; ++i) {
+	if(sv.data[i] < '0' || sv.data[i] > '9') return SV_PARSE_INVALID;
+	const uint64_t digit = sv.data[i] - '0';
+	if(may_overflow && (value > UINT64_MAX / 10 || (value == UINT64_MAX / 10 && digit > UINT64_MAX % 10))) {
+	    overflow = true;
+	}
+	value = value * 10 + digit;
+    }
+
+    if(overflow) return SV_PARSE_OVERFLOW;
+    *result = value;
+    return SV_PARSE_OK;
+}
+
+Sv_Parse_Result sv_parse_hex_u64(String_View sv, uint64_t *result) {
+    if(sv.count == 0) return SV_PARSE_INVALID;
+
+    uint64_t value = 0;
+    bool overflow = false;
+    size_t i = 0;
+#ifdef SV_SWAR
+    for(; i + 8 <= sv.count; i += 8) {
+	uint64_t digits;
+	if(!sv_swar_hex8(sv.data + i, &digits)) return SV_PARSE_INVALID;
+	if(value >> 32) overflow = true;
+	value = (value << 32) | digits;
+    }
+#endif
+    for(; i < sv.count; ++i) {
+	const int digit = sv_hex_digit(sv.data[i]);
+	if(digit < 0) return SV_PARSE_INVALID;
+	if(value >> 60) overflow = true;
+	value = (value << 4) | digit;
+    }
+
+    if(overflow) return SV_PARSE_OVERFLOW;
+    *result = value;
+    return SV_PARSE_OK;
+}
+
 bool sv_starts_with(String_View sv, String_View prefix) {
     if(sv.count >= prefix.count) {
 	const String_View temp = {
@@ -87,3 +375,40 @@ bool sv_ends_with(String_View sv, String_View suffix) {
     }
     return false;
 }
+
+bool sv_index_of(String_View sv, char c, size_t *index) {
+    size_t i = sv_scan_byte(sv.data, sv.count, c);
+    if(i >= sv.count) return false;
+    if(index) *index = i;
+    return true;
+}
+
+bool sv_find_crlf(String_View sv, size_t *index) {
+    size_t i = sv_scan_crlf(sv.data, sv.count);
+    if(i >= sv.count) return false;
+    if(index) *index = i;
+    return true;
+}
+
+bool sv_find_crlfcrlf(String_View sv, size_t *index) {
+    size_t i = sv_scan_crlfcrlf(sv.data, sv.count);
+    if(i >= sv.count) return false;
+    if(index) *index = i;
+    return true;
+}
+
+bool sv_chop_line(String_View *sv, String_View *line) {
+    size_t i = 0;
+    if(!sv_find_crlf(*sv, &i)) return false;
+
+    if(line) {
+	*line = (String_View) {
+	    .count = i,
+	    .data = sv->data,
+	};
+    }
+
+    sv->count -= i + 2;
+    sv->data += i + 2;
+    return true;
+}
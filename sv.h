@@ -20,9 +20,38 @@ void sv_trim_left(String_View *sv);
 void sv_trim_right(String_View *sv);
 void sv_trim(String_View *sv);
 int sv_eq(String_View a, String_View b);
+bool sv_eq_ignorecase(String_View a, String_View b);
 uint64_t sv_to_u64(String_View a);
+uint64_t sv_hex_to_u64(String_View a);
+
+typedef enum {
+    SV_PARSE_OK,
+    // * Empty, or has something that is not a digit
+    SV_PARSE_INVALID,
+    // * Does not fit into 64 bits
+    SV_PARSE_OVERFLOW,
+} Sv_Parse_Result;
+
+// * Strict versions of the above: the whole view must be digits (no sign,
+// * no spaces), leading zeros are fine. `result` is only set on SV_PARSE_OK.
+// * Eight digits are checked and converted at a time.
+Sv_Parse_Result sv_parse_u64(String_View sv, uint64_t *result);
+Sv_Parse_Result sv_parse_hex_u64(String_View sv, uint64_t *result);
 
 bool sv_starts_with(String_View sv, String_View suffix);
 bool sv_ends_with(String_View sv, String_View suffix);
 
+// * Searching. All of them return false when nothing is found, otherwise
+// * they store the position of the first match into `index`.
+// * On x86_64 these use SSE2 or AVX2 kernels picked at startup.
+bool sv_index_of(String_View sv, char c, size_t *index);
+// * Position of the first "\r\n"
+bool sv_find_crlf(String_View sv, size_t *index);
+// * Position of the first "\r\n\r\n"
+bool sv_find_crlfcrlf(String_View sv, size_t *index);
+// * Chops a "\r\n" terminated line off the front of `sv` and stores it
+// * into `line` without the terminator. Leaves `sv` untouched and returns
+// * false if there is no complete line yet.
+bool sv_chop_line(String_View *sv, String_View *line);
+
 #endif // * SV_H_
\ No newline at end of file
@@ -0,0 +1,167 @@
+#define _GNU_SOURCE
+
+#include<stdint.h>
+#include<string.h>
+#include<errno.h>
+#include<time.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/syscall.h>
+
+#include "./uring.h"
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t arg_size) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+bool imhttp_uring_init(ImHTTP_Uring *uring, unsigned entries) {
+    memset(uring, 0, sizeof(*uring));
+    uring->fd = -1;
+
+    // * Every connection can have a connect, a send and a receive in flight
+    struct io_uring_params params = {0};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+
+    int fd = uring_setup(entries, &params);
+    if(fd < 0) return false;
+
+    // * Timed waits rely on IORING_ENTER_EXT_ARG
+    if(!(params.features & IORING_FEAT_EXT_ARG)) {
+	close(fd);
+	errno = ENOSYS;
+	return false;
+    }
+
+    uring->fd = fd;
+    uring->features = params.features;
+    uring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+	if(uring->cq_map_size > uring->sq_map_size) uring->sq_map_size = uring->cq_map_size;
+	uring->cq_map_size = uring->sq_map_size;
+    }
+
+    uring->sq_map = mmap(NULL, uring->sq_map_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(uring->sq_map == MAP_FAILED) goto fail;
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+	uring->cq_map = uring->sq_map;
+    } else {
+	uring->cq_map = mmap(NULL, uring->cq_map_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	if(uring->cq_map == MAP_FAILED) goto fail;
+    }
+
+    uring->sqes_map_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqes_map_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(uring->sqes == MAP_FAILED) goto fail;
+
+    char *sq = uring->sq_map;
+    uring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    uring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    uring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    uring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    uring->sq_entries = params.sq_entries;
+    uring->sqe_tail = *uring->sq_tail;
+
+    char *cq = uring->cq_map;
+    uring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    uring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    uring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    return true;
+
+fail: {
+	int saved_errno = errno;
+	imhttp_uring_free(uring);
+	errno = saved_errno;
+	return false;
+    }
+}
+
+struct io_uring_sqe *imhttp_uring_get_sqe(ImHTTP_Uring *uring) {
+    unsigned head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+    if(uring->sqe_tail - head >= uring->sq_entries) {
+	if(imhttp_uring_submit(uring) < 0) return NULL;
+	head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+	if(uring->sqe_tail - head >= uring->sq_entries) return NULL;
+    }
+
+    unsigned index = uring->sqe_tail & *uring->sq_mask;
+    uring->sq_array[index] = index;
+    uring->sqe_tail += 1;
+
+    struct io_uring_sqe *sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// * Makes the prepared entries visible to the kernel and returns how many there are
+static unsigned uring_publish(ImHTTP_Uring *uring) {
+    __atomic_store_n(uring->sq_tail, uring->sqe_tail, __ATOMIC_RELEASE);
+    return uring->sqe_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+int imhttp_uring_submit(ImHTTP_Uring *uring) {
+    unsigned to_submit = uring_publish(uring);
+    if(to_submit == 0) return 0;
+    for(;;) {
+	int n = uring_enter(uring->fd, to_submit, 0, 0, NULL, 0);
+	if(n < 0 && errno == EINTR) continue;
+	return n;
+    }
+}
+
+int imhttp_uring_wait(ImHTTP_Uring *uring, int timeout_ms) {
+    unsigned to_submit = uring_publish(uring);
+
+    struct __kernel_timespec ts = {
+	.tv_sec = timeout_ms / 1000,
+	.tv_nsec = (timeout_ms % 1000) * 1000000LL,
+    };
+    struct io_uring_getevents_arg arg = {0};
+    if(timeout_ms >= 0) arg.ts = (unsigned long long) (uintptr_t) &ts;
+
+    int n = uring_enter(uring->fd, to_submit, timeout_ms == 0 ? 0 : 1,
+			IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    // * Running out of time or getting interrupted is not an error
+    if(n < 0 && (errno == ETIME || errno == EINTR)) return 0;
+    return n;
+}
+
+bool imhttp_uring_peek_cqe(ImHTTP_Uring *uring, struct io_uring_cqe **cqe) {
+    unsigned head = *uring->cq_head;
+    if(head == __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) return false;
+    *cqe = &uring->cqes[head & *uring->cq_mask];
+    return true;
+}
+
+void imhttp_uring_cqe_seen(ImHTTP_Uring *uring) {
+    __atomic_store_n(uring->cq_head, *uring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+bool imhttp_uring_register_buffers(ImHTTP_Uring *uring, const struct iovec *iov, unsigned count) {
+    return syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_BUFFERS, iov, count) == 0;
+}
+
+void imhttp_uring_free(ImHTTP_Uring *uring) {
+    if(uring->sqes != NULL && uring->sqes != MAP_FAILED) {
+	munmap(uring->sqes, uring->sqes_map_size);
+    }
+    if(uring->cq_map != NULL && uring->cq_map != MAP_FAILED && uring->cq_map != uring->sq_map) {
+	munmap(uring->cq_map, uring->cq_map_size);
+    }
+    if(uring->sq_map != NULL && uring->sq_map != MAP_FAILED) {
+	munmap(uring->sq_map, uring->sq_map_size);
+    }
+    if(uring->fd >= 0) close(uring->fd);
+    memset(uring, 0, sizeof(*uring));
+    uring->fd = -1;
+}
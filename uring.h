@@ -0,0 +1,53 @@
+#ifndef URING_H_
+#define URING_H_
+
+#include<stdbool.h>
+#include<stddef.h>
+#include<sys/uio.h>
+#include<linux/io_uring.h>
+
+// * Minimal io_uring wrapper on top of the raw syscalls (no liburing).
+// *
+// * Submission entries are only handed to the kernel by imhttp_uring_submit()
+// * or imhttp_uring_wait(), so everything prepared in between goes out with a
+// * single io_uring_enter().
+
+typedef struct {
+    int fd;
+    unsigned features;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    // * Entries handed out by imhttp_uring_get_sqe() but not published yet
+    unsigned sqe_tail;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    size_t sqes_map_size;
+} ImHTTP_Uring;
+
+// * Returns false (with errno set) if io_uring is not available
+bool imhttp_uring_init(ImHTTP_Uring *uring, unsigned entries);
+// * Returns a zeroed entry or NULL if the submission queue is full even after submitting
+struct io_uring_sqe *imhttp_uring_get_sqe(ImHTTP_Uring *uring);
+// * Returns the number of entries the kernel took or -1 on error
+int imhttp_uring_submit(ImHTTP_Uring *uring);
+// * Submits and waits up to `timeout_ms` (-1 forever) for at least one completion
+int imhttp_uring_wait(ImHTTP_Uring *uring, int timeout_ms);
+bool imhttp_uring_peek_cqe(ImHTTP_Uring *uring, struct io_uring_cqe **cqe);
+void imhttp_uring_cqe_seen(ImHTTP_Uring *uring);
+bool imhttp_uring_register_buffers(ImHTTP_Uring *uring, const struct iovec *iov, unsigned count);
+void imhttp_uring_free(ImHTTP_Uring *uring);
+
+#endif // * URING_H_